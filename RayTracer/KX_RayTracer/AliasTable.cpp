@@ -0,0 +1,80 @@
+#include "AliasTable.h"
+#include <algorithm>
+
+void AliasTable::Build(const std::vector<float>& weights)
+{
+	int n = static_cast<int>(weights.size());
+	bins.assign(n, Bin());
+	pmfs.assign(n, 0.0f);
+	if (n == 0)
+		return;
+
+	double total = 0.0;
+	for (int i = 0; i < n; i++)
+		total += weights[i];
+
+	for (int i = 0; i < n; i++)
+		pmfs[i] = total > 0.0 ? static_cast<float>(weights[i] / total) : 1.0f / n;
+
+	// Vose's method: split the bins into the ones below and above the
+	// average, and let each small bin borrow the rest from a large one.
+	std::vector<double> scaled(n);
+	std::vector<int> small, large;
+	for (int i = 0; i < n; i++) {
+		scaled[i] = static_cast<double>(pmfs[i]) * n;
+		if (scaled[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+
+	while (!small.empty() && !large.empty()) {
+		int s = small.back(); small.pop_back();
+		int l = large.back(); large.pop_back();
+
+		bins[s].threshold = static_cast<float>(scaled[s]);
+		bins[s].alias = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+			small.push_back(l);
+		else
+			large.push_back(l);
+	}
+
+	// Whatever is left is 1 up to rounding errors.
+	for (size_t i = 0; i < large.size(); i++) {
+		bins[large[i]].threshold = 1.0f;
+		bins[large[i]].alias = large[i];
+	}
+	for (size_t i = 0; i < small.size(); i++) {
+		bins[small[i]].threshold = 1.0f;
+		bins[small[i]].alias = small[i];
+	}
+}
+
+int AliasTable::Sample(float u, float *pmf, float *uRemapped) const
+{
+	int n = static_cast<int>(bins.size());
+	float scaled = u * n;
+	int index = static_cast<int>(scaled);
+	if (index >= n)
+		index = n - 1;
+
+	// Reuse the fractional part of 'u' to choose between the bin and its
+	// alias, which leaves it uniform inside the part that was chosen.
+	float threshold = bins[index].threshold;
+	float frac = scaled - index;
+	if (frac >= threshold) {
+		index = bins[index].alias;
+		if (uRemapped)
+			*uRemapped = std::min((frac - threshold) / (1 - threshold), 0.99999994f);
+	}
+	else if (uRemapped) {
+		*uRemapped = std::min(frac / threshold, 0.99999994f);
+	}
+
+	if (pmf)
+		*pmf = pmfs[index];
+	return index;
+}
@@ -0,0 +1,33 @@
+// Alias table for sampling a discrete distribution in constant time.
+#ifndef _ALIASTABLE_H
+#define _ALIASTABLE_H
+
+#include <vector>
+
+class AliasTable
+{
+public:
+	// Build the table from non-negative 'weights'. If all the weights are
+	// zero, every entry gets the same probability.
+	void Build(const std::vector<float>& weights);
+
+	// Pick an entry with 'u' in [0, 1), and store its probability in 'pmf'
+	// if 'pmf' is not NULL. If 'uRemapped' is not NULL, store in it a new
+	// number in [0, 1), made from what is left of 'u' after the pick.
+	int Sample(float u, float *pmf, float *uRemapped = nullptr) const;
+
+	float Pmf(int index) const { return pmfs[index]; }
+
+	int Size() const { return static_cast<int>(pmfs.size()); }
+
+private:
+	struct Bin {
+		float threshold;	// probability of keeping this bin
+		int alias;			// bin to pick otherwise
+	};
+
+	std::vector<Bin> bins;
+	std::vector<float> pmfs;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<bool> fCounting(false);
+static std::atomic<long long> allocations(0);
+
+void StartCountingAllocations()
+{
+	allocations.store(0);
+	fCounting.store(true);
+}
+
+long long StopCountingAllocations()
+{
+	fCounting.store(false);
+	return allocations.load();
+}
+
+// The array and nothrow forms of new call this one by default, and the
+// other forms of delete call the matching delete.
+void* operator new(std::size_t size)
+{
+	if (fCounting.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	free(p);
+}
@@ -0,0 +1,15 @@
+// Counts the heap allocations made through operator new.
+// This file replaces the global operator new and delete for the whole
+// program. They only count while counting is on, so that a check can tell
+// whether some code allocates, such as tracing once the per-thread scratch
+// arenas have grown.
+#ifndef _ALLOCATIONCOUNTER_H
+#define _ALLOCATIONCOUNTER_H
+
+// Start counting the allocations of all threads from zero.
+void StartCountingAllocations();
+
+// Stop counting, and return the allocations made since the start.
+long long StopCountingAllocations();
+
+#endif
@@ -0,0 +1,440 @@
+#include "BDPT.h"
+#include "Sampler.h"
+#include <algorithm>
+
+enum class VertexType : char {
+	CAMERA,
+	LIGHT,		// start of a light subpath, or a light point sampled for a connection
+	SURFACE,
+};
+
+struct PathVertex {
+	VertexType type;
+	Point3f p;
+	Vector3f n;			// geometric normal, not flipped
+	Vector3f wo;		// unit direction towards the previous vertex of its subpath
+	const Surface *s;	// NULL for the camera
+	RGBColor beta;		// throughput from the start of the subpath up to this vertex
+	bool delta;			// on a specular surface, cannot be connected
+	float pdfFwd;		// area density of sampling this vertex from its subpath
+	float pdfRev;		// area density of sampling it from the other end
+
+	PathVertex() {
+		type = VertexType::SURFACE;
+		s = nullptr;
+		delta = false;
+		pdfFwd = 0.0f;
+		pdfRev = 0.0f;
+	}
+
+	bool fIsConnectible() const { return !delta; }
+};
+
+static bool fIsBlack(const RGBColor& c)
+{
+	return c.r == 0 && c.g == 0 && c.b == 0;
+}
+
+static Vector3f direction(const Point3f& from, const Point3f& to)
+{
+	Vector3f w(from /*start*/, to /*end*/);
+	w.Normalize();
+	return w;
+}
+
+// Lambertian BSDF for the unit directions 'wo' and 'wi' pointing away from
+// 'v'. Diffuse surfaces reflect on both sides, like in Ray::traceForColor.
+static RGBColor evalBSDF(const PathVertex& v, const Vector3f& wo, const Vector3f& wi)
+{
+	if (v.type != VertexType::SURFACE || v.delta)
+		return RGBColor();
+	if (dot(wo, v.n) * dot(wi, v.n) <= 0)
+		return RGBColor();
+	return v.s->GetMaterialRecord().materialColor * static_cast<float>(1 / M_PI);
+}
+
+static float pdfBSDF(const PathVertex& v, const Vector3f& wo, const Vector3f& wi)
+{
+	if (v.type != VertexType::SURFACE || v.delta)
+		return 0.0f;
+	if (dot(wo, v.n) * dot(wi, v.n) <= 0)
+		return 0.0f;
+	return static_cast<float>(fabs(dot(wi, v.n)) / M_PI);
+}
+
+// Radiance emitted by 'v' along the unit direction 'w'. Lights only emit on
+// the side their normal points to.
+static RGBColor emitted(const PathVertex& v, const Vector3f& w)
+{
+	if (v.s == nullptr || !v.s->fIsLight() || dot(v.n, w) <= 0)
+		return RGBColor();
+	return v.s->GetMaterialRecord().emissionColor;
+}
+
+// Turn a solid angle density at 'from' into an area density at 'to'.
+static float convertDensity(float pdf, const PathVertex& from, const PathVertex& to)
+{
+	Vector3f w(from.p /*start*/, to.p /*end*/);
+	float dist2 = dot(w, w);
+	if (dist2 == 0)
+		return 0.0f;
+
+	if (to.type != VertexType::CAMERA)
+		pdf *= static_cast<float>(fabs(dot(to.n, w * (1.0f / sqrt(dist2)))));
+	return pdf / dist2;
+}
+
+BDPT::BDPT(const Scene& _scene, const Camera& _camera) : scene(_scene), camera(_camera)
+{
+}
+
+bool BDPT::Visible(const Point3f& p0, const Point3f& p1) const
+{
+	Vector3f w(p0 /*start*/, p1 /*end*/);
+	float dist = sqrt(dot(w, w));
+	Ray ray(p0, w);
+	return !scene.GetRoot().Hit(ray, RAY_T0, dist * 0.999f, nullptr, nullptr, nullptr);
+}
+
+float BDPT::Pdf(const PathVertex& v, const PathVertex *prev, const PathVertex& next) const
+{
+	if (v.type == VertexType::LIGHT)
+		return PdfLight(v, next);
+
+	Vector3f wn = direction(v.p, next.p);
+	float pdf;
+	if (v.type == VertexType::CAMERA)
+		pdf = camera.PdfDir(wn);
+	else
+		pdf = pdfBSDF(v, direction(v.p, prev->p), wn);
+
+	return convertDensity(pdf, v, next);
+}
+
+float BDPT::PdfLight(const PathVertex& v, const PathVertex& next) const
+{
+	// Lights emit with a cosine-weighted distribution on their front side.
+	float cosTheta = dot(v.n, direction(v.p, next.p));
+	if (cosTheta <= 0)
+		return 0.0f;
+	return convertDensity(static_cast<float>(cosTheta / M_PI), v, next);
+}
+
+float BDPT::PdfLightOrigin(const PathVertex& v) const
+{
+	if (v.s == nullptr)
+		return 0.0f;
+
+	const LightTable& lights = scene.GetLights();
+	int index = lights.IndexOf(v.s);
+	if (index < 0)
+		return 0.0f;
+	return lights.Pmf(index) / lights[index].area;
+}
+
+int BDPT::RandomWalk(ThreadContext& ctx, Ray ray, RGBColor beta, float pdfDir, int maxVertices, PathVertex *path) const
+{
+	int bounces = 0;
+	float pdfFwd = pdfDir;
+
+	while (bounces < maxVertices) {
+		float t;
+		Surface *s = nullptr;
+		Vector3f normal;
+		ctx.segments++;
+
+		if (!scene.GetRoot().Hit(ray, RAY_T0, RAY_T1, &t, &s, &normal) || s == nullptr || !s->fHasMaterial())
+			break;
+
+		PathVertex& prev = path[bounces];
+		PathVertex& v = path[bounces + 1];
+		normal.Normalize();
+		v.type = VertexType::SURFACE;
+		v.p = ray.origin + ray.direction * t;
+		v.n = normal;
+		v.wo = ray.direction * -1;
+		v.s = s;
+		v.beta = beta;
+		v.delta = false;
+		v.pdfFwd = convertDensity(pdfFwd, prev, v);
+		v.pdfRev = 0.0f;
+		bounces++;
+
+		if (bounces >= maxVertices)
+			break;
+
+		// Sample the next direction.
+		const MaterialRecord& material = s->GetMaterialRecord();
+		bool fOutSideIn = dot(normal, ray.direction) < 0;
+		Vector3f nf = fOutSideIn ? normal : normal * -1;	// facing the incoming ray
+		Vector3f wi;
+		float pdfNext, pdfPrev;
+
+		if (material.reflType == Type::DIFF) {
+			wi = sampleCosineHemisphere(nf, ctx.rng.NextFloat(), ctx.rng.NextFloat());
+			pdfNext = static_cast<float>(dot(wi, nf) / M_PI);
+			pdfPrev = static_cast<float>(dot(v.wo, nf) / M_PI);
+			beta = beta * material.materialColor;
+		}
+		else {
+			Vector3f reflDir = ray.direction - nf * 2.0f * dot(ray.direction, nf);
+			wi = reflDir;
+			if (material.reflType == Type::REFR) {
+				float ni = fOutSideIn ? material.extrRefrIndex : material.refrIndex;
+				float nt = fOutSideIn ? material.refrIndex : material.extrRefrIndex;
+				Vector3f refrDir;
+				if (ctx.rng.NextFloat() >= refractDielectric(ray.direction, nf, ni, nt, &refrDir))
+					wi = refrDir;
+			}
+			beta = beta * material.materialColor;
+			v.delta = true;
+			pdfNext = 0.0f;
+			pdfPrev = 0.0f;
+		}
+
+		if (fIsBlack(beta))
+			break;
+
+		// Russian roulette, the same way as Ray::traceForColor.
+		if (bounces > minPathDepth) {
+			float survival = std::min(std::max(beta.r, std::max(beta.g, beta.b)), 0.95f);
+			if (ctx.rng.NextFloat() >= survival)
+				break;
+			beta = beta * (1.0f / survival);
+		}
+
+		prev.pdfRev = convertDensity(pdfPrev, v, prev);
+		pdfFwd = pdfNext;
+		ray = Ray(v.p, wi);
+	}
+
+	return bounces;
+}
+
+float BDPT::MISWeight(ThreadContext& ctx, const PathVertex *lightPath, const PathVertex *cameraPath, const PathVertex& sampled, int s, int t) const
+{
+	if (s + t == 2)
+		return 1.0f;
+
+	// Work on copies of the subpaths, updated to what they look like for
+	// this strategy.
+	ScratchArena::Mark mark = ctx.arena.GetMark();
+	PathVertex *lv = ctx.arena.Alloc<PathVertex>(s);
+	PathVertex *cv = ctx.arena.Alloc<PathVertex>(t);
+	std::copy(lightPath, lightPath + s, lv);
+	std::copy(cameraPath, cameraPath + t, cv);
+
+	if (s == 1)
+		lv[0] = sampled;
+	else if (t == 1)
+		cv[0] = sampled;
+
+	PathVertex *qs = s > 0 ? &lv[s - 1] : nullptr;
+	PathVertex *pt = &cv[t - 1];
+	PathVertex *qsMinus = s > 1 ? &lv[s - 2] : nullptr;
+	PathVertex *ptMinus = t > 1 ? &cv[t - 2] : nullptr;
+
+	// The connection vertices are not specular, otherwise the strategy would
+	// not have been used.
+	pt->delta = false;
+	if (qs)
+		qs->delta = false;
+
+	pt->pdfRev = s > 0 ? Pdf(*qs, qsMinus, *pt) : PdfLightOrigin(*pt);
+	if (ptMinus)
+		ptMinus->pdfRev = s > 0 ? Pdf(*pt, qs, *ptMinus) : PdfLight(*pt, *ptMinus);
+	if (qs)
+		qs->pdfRev = Pdf(*pt, ptMinus, *qs);
+	if (qsMinus)
+		qsMinus->pdfRev = Pdf(*qs, pt, *qsMinus);
+
+	// Sum the ratios of the densities of the other strategies to this one.
+	// Specular vertices have zero densities, which are skipped.
+	float sumRi = 0.0f;
+	float ri = 1.0f;
+	for (int i = t - 1; i > 0; i--) {
+		ri *= (cv[i].pdfRev != 0 ? cv[i].pdfRev : 1) / (cv[i].pdfFwd != 0 ? cv[i].pdfFwd : 1);
+		if (!cv[i].delta && !cv[i - 1].delta)
+			sumRi += ri;
+	}
+
+	ri = 1.0f;
+	for (int i = s - 1; i >= 0; i--) {
+		ri *= (lv[i].pdfRev != 0 ? lv[i].pdfRev : 1) / (lv[i].pdfFwd != 0 ? lv[i].pdfFwd : 1);
+		bool fDeltaBefore = i > 0 ? lv[i - 1].delta : false;	// area lights are never delta
+		if (!lv[i].delta && !fDeltaBefore)
+			sumRi += ri;
+	}
+
+	ctx.arena.Rewind(mark);
+	return 1.0f / (1.0f + sumRi);
+}
+
+RGBColor BDPT::Connect(ThreadContext& ctx, PathVertex *lightPath, PathVertex *cameraPath, int s, int t, int *w, int *h) const
+{
+	RGBColor L;
+	PathVertex sampled;
+
+	if (s == 0) {
+		// The camera subpath hit a light by itself.
+		const PathVertex& pt = cameraPath[t - 1];
+		L = pt.beta * emitted(pt, pt.wo);
+	}
+	else if (t == 1) {
+		// Connect the light subpath to the camera.
+		const PathVertex& qs = lightPath[s - 1];
+		if (!qs.fIsConnectible())
+			return RGBColor();
+
+		Vector3f toEye(qs.p /*start*/, camera.GetEye() /*end*/);
+		float dist2 = dot(toEye, toEye);
+		toEye.Normalize();
+		Vector3f dir = toEye * -1;
+		if (!camera.GetRasterPosition(dir, w, h))
+			return RGBColor();
+
+		// Importance arriving from the camera through the sampled direction.
+		float pdf = dist2 / dot(dir, camera.GetForward());
+		sampled.type = VertexType::CAMERA;
+		sampled.p = camera.GetEye();
+		sampled.n = camera.GetForward();
+		sampled.beta = RGBColor(1.0f, 1.0f, 1.0f) * (camera.We(dir) / pdf);
+
+		L = qs.beta * evalBSDF(qs, qs.wo, toEye) * sampled.beta * static_cast<float>(fabs(dot(toEye, qs.n)));
+		if (fIsBlack(L) || !Visible(qs.p, camera.GetEye()))
+			return RGBColor();
+	}
+	else if (s == 1) {
+		// Connect the camera subpath to a new point on a light.
+		const PathVertex& pt = cameraPath[t - 1];
+		const LightTable& lights = scene.GetLights();
+		if (!pt.fIsConnectible() || lights.Size() == 0)
+			return RGBColor();
+
+		float pmf;
+		int lightIndex = lights.Sample(ctx.rng.NextFloat(), &pmf);
+		const LightEntry& entry = lights[lightIndex];
+		Point3f lp;
+		Vector3f ln;
+		if (!entry.light->SamplePoint(ctx.rng.NextFloat(), ctx.rng.NextFloat(), &lp, &ln))
+			return RGBColor();
+
+		Vector3f toLight(pt.p /*start*/, lp /*end*/);
+		float dist2 = dot(toLight, toLight);
+		toLight.Normalize();
+		float cosLight = -dot(ln, toLight);
+		if (cosLight <= 0 || dist2 == 0)
+			return RGBColor();
+
+		float pdf = dist2 / (entry.area * cosLight);	// solid angle density of the light point
+		sampled.type = VertexType::LIGHT;
+		sampled.p = lp;
+		sampled.n = ln;
+		sampled.s = entry.light;
+		sampled.beta = entry.light->GetMaterialRecord().emissionColor * (1.0f / (pdf * pmf));
+		sampled.pdfFwd = PdfLightOrigin(sampled);
+
+		L = pt.beta * evalBSDF(pt, pt.wo, toLight) * sampled.beta * static_cast<float>(fabs(dot(toLight, pt.n)));
+		if (fIsBlack(L) || !Visible(pt.p, lp))
+			return RGBColor();
+	}
+	else {
+		// Connect the two subpaths at their last vertices.
+		const PathVertex& qs = lightPath[s - 1];
+		const PathVertex& pt = cameraPath[t - 1];
+		if (!qs.fIsConnectible() || !pt.fIsConnectible())
+			return RGBColor();
+
+		Vector3f d(pt.p /*start*/, qs.p /*end*/);
+		float dist2 = dot(d, d);
+		if (dist2 == 0)
+			return RGBColor();
+		d.Normalize();
+
+		L = qs.beta * evalBSDF(qs, qs.wo, d * -1) * evalBSDF(pt, pt.wo, d) * pt.beta;
+		if (fIsBlack(L))
+			return RGBColor();
+
+		float g = static_cast<float>(fabs(dot(d, pt.n)) * fabs(dot(d, qs.n))) / dist2;
+		L = L * g;
+		if (!Visible(pt.p, qs.p))
+			return RGBColor();
+	}
+
+	if (fIsBlack(L))
+		return RGBColor();
+
+	return L * MISWeight(ctx, lightPath, cameraPath, sampled, s, t);
+}
+
+RGBColor BDPT::Trace(ThreadContext& ctx, int w, int h, SplatBuffer& splats) const
+{
+	int maxDepth = maxPathDepth;
+	ScratchArena::Mark mark = ctx.arena.GetMark();
+	PathVertex *cameraPath = ctx.arena.Alloc<PathVertex>(maxDepth + 2);
+	PathVertex *lightPath = ctx.arena.Alloc<PathVertex>(maxDepth + 1);
+
+	// Camera subpath.
+	float u1, u2;
+	ctx.sampler->Get2D(&u1, &u2);
+	Ray cameraRay = camera.GenerateRay(w, h, u1, u2);
+	cameraPath[0].type = VertexType::CAMERA;
+	cameraPath[0].p = camera.GetEye();
+	cameraPath[0].n = camera.GetForward();
+	cameraPath[0].beta = RGBColor(1.0f, 1.0f, 1.0f);
+	int nCamera = 1 + RandomWalk(ctx, cameraRay, cameraPath[0].beta, camera.PdfDir(cameraRay.direction), maxDepth + 1, cameraPath);
+
+	// Light subpath, from a light picked by power.
+	int nLight = 0;
+	const LightTable& lights = scene.GetLights();
+	if (lights.Size() > 0) {
+		float pmf;
+		const LightEntry& entry = lights[lights.Sample(ctx.rng.NextFloat(), &pmf)];
+		Point3f lp;
+		Vector3f ln;
+		if (entry.light->SamplePoint(ctx.rng.NextFloat(), ctx.rng.NextFloat(), &lp, &ln)) {
+			float pdfPos = 1.0f / entry.area;
+			Vector3f dir = sampleCosineHemisphere(ln, ctx.rng.NextFloat(), ctx.rng.NextFloat());
+			float pdfDir = static_cast<float>(dot(dir, ln) / M_PI);
+			RGBColor Le = entry.light->GetMaterialRecord().emissionColor;
+
+			lightPath[0].type = VertexType::LIGHT;
+			lightPath[0].p = lp;
+			lightPath[0].n = ln;
+			lightPath[0].s = entry.light;
+			lightPath[0].beta = Le * (1.0f / (pmf * pdfPos));
+			lightPath[0].pdfFwd = pmf * pdfPos;
+
+			if (pdfDir > 0) {
+				RGBColor beta = Le * (dot(dir, ln) / (pmf * pdfPos * pdfDir));
+				nLight = 1 + RandomWalk(ctx, Ray(lp, dir), beta, pdfDir, maxDepth, lightPath);
+			}
+			else {
+				nLight = 1;
+			}
+		}
+	}
+
+	// Run every strategy.
+	RGBColor L;
+	for (int t = 1; t <= nCamera; t++) {
+		for (int s = 0; s <= nLight; s++) {
+			int depth = t + s - 2;
+			if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
+				continue;
+
+			int splatW, splatH;
+			RGBColor contribution = Connect(ctx, lightPath, cameraPath, s, t, &splatW, &splatH);
+			if (t == 1) {
+				if (!fIsBlack(contribution))
+					splats.Add(splatW, splatH, contribution);
+			}
+			else {
+				L = L + contribution;
+			}
+		}
+	}
+
+	ctx.arena.Rewind(mark);
+	return L;
+}
@@ -0,0 +1,55 @@
+// Bidirectional path tracer.
+// Each camera sample traces one subpath from the camera and one from a light
+// source, connects every prefix of the first to every prefix of the second,
+// and weights the resulting strategies with multiple importance sampling
+// (balance heuristic). Strategies that connect a light subpath straight to
+// the camera can land in any pixel, so they are splatted into a SplatBuffer.
+#ifndef _BDPT_H
+#define _BDPT_H
+
+#include "Camera.h"
+#include "Scene.h"
+#include "SplatBuffer.h"
+#include "ThreadContext.h"
+
+struct PathVertex;
+
+class BDPT
+{
+public:
+	BDPT(const Scene& _scene, const Camera& _camera);
+
+	// Return the radiance of the sample of pixel (w, h) started on the
+	// context's sampler. The light tracing
+	// contributions are added to 'splats', which must be scaled by one over
+	// the samples per pixel at the end.
+	RGBColor Trace(ThreadContext& ctx, int w, int h, SplatBuffer& splats) const;
+
+private:
+	// Extend the subpath starting at path[0] along 'ray', and return the
+	// number of vertices added.
+	int RandomWalk(ThreadContext& ctx, Ray ray, RGBColor beta, float pdfDir, int maxVertices, PathVertex *path) const;
+
+	// Return the contribution of the strategy using 's' light vertices and
+	// 't' camera vertices. For t == 1 the pixel hit is stored in 'w', 'h'.
+	RGBColor Connect(ThreadContext& ctx, PathVertex *lightPath, PathVertex *cameraPath, int s, int t, int *w, int *h) const;
+
+	float MISWeight(ThreadContext& ctx, const PathVertex *lightPath, const PathVertex *cameraPath, const PathVertex& sampled, int s, int t) const;
+
+	// Density of 'v' sampling 'next' after being reached from 'prev', as an
+	// area density at 'next'.
+	float Pdf(const PathVertex& v, const PathVertex *prev, const PathVertex& next) const;
+
+	// Density of a light vertex 'v' emitting towards 'next'.
+	float PdfLight(const PathVertex& v, const PathVertex& next) const;
+
+	// Density of picking 'v' as the start of a light subpath.
+	float PdfLightOrigin(const PathVertex& v) const;
+
+	bool Visible(const Point3f& p0, const Point3f& p1) const;
+
+	const Scene& scene;
+	const Camera& camera;
+};
+
+#endif
@@ -0,0 +1,62 @@
+// Pool of objects that are only ever added, for structures that threads
+// grow at the same time without locks. Objects are carved from blocks of
+// 'blockSize' of them, so only one in 'blockSize' allocations goes to the
+// heap, and a thread that finds a block missing makes it with a single
+// compare-and-swap. Objects are never destroyed one by one: they must be
+// trivially destructible, and live until the pool is destroyed.
+#ifndef _BLOCKPOOL_H
+#define _BLOCKPOOL_H
+
+#include <atomic>
+#include <new>
+
+template <typename T, int blockSize, int maxBlocks>
+class BlockPool
+{
+public:
+	BlockPool() : next(0), blockCount(0) {
+		for (int i = 0; i < maxBlocks; i++)
+			blocks[i] = nullptr;
+	}
+
+	~BlockPool() {
+		for (int i = 0; i < maxBlocks; i++)
+			::operator delete(blocks[i].load());
+	}
+
+	// Return a new default constructed object, or nullptr once all the
+	// 'maxBlocks' blocks are used up. Safe to call from several threads at
+	// once.
+	T* New() {
+		long long index = next.fetch_add(1, std::memory_order_relaxed);
+		if (index >= static_cast<long long>(blockSize) * maxBlocks)
+			return nullptr;
+		int block = static_cast<int>(index / blockSize);
+
+		T *items = blocks[block].load();
+		if (items == nullptr) {
+			T *created = static_cast<T*>(::operator new(blockSize * sizeof(T)));
+			if (blocks[block].compare_exchange_strong(items, created)) {
+				items = created;
+				blockCount++;
+			}
+			else {
+				::operator delete(created);		// another thread got there first, 'items' holds its block
+			}
+		}
+		return new (items + index % blockSize) T();
+	}
+
+	// Blocks taken from the heap so far.
+	int GetBlockCount() const { return blockCount; }
+
+private:
+	BlockPool(const BlockPool&);
+	BlockPool& operator=(const BlockPool&);
+
+	std::atomic<long long> next;
+	std::atomic<T*> blocks[maxBlocks];
+	std::atomic<int> blockCount;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "BlueNoise.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "RNG.h"
+
+// Width of the Gaussian that measures how clustered the pixels are, in pixels.
+static const float CLUSTER_SIGMA = 1.5f;
+
+// Distance past which the Gaussian is left out, 4 sigmas.
+static const int CLUSTER_RADIUS = 6;
+
+// How far apart the first thresholds of two pixels must be for their second
+// ones not to repel each other any more.
+static const float SAMPLE_SIGMA = 0.1f;
+
+// Share of the pixels set in the initial pattern.
+static const float INITIAL_FRACTION = 0.1f;
+
+namespace {
+
+// Binary pattern on a torus, with the Gaussian-weighted density of the set
+// pixels around every pixel.
+class Pattern
+{
+public:
+	Pattern(int _size, const std::vector<float> *_previous) : size(_size), radius(std::min(CLUSTER_RADIUS, (_size - 1) / 2)),
+		previous(_previous), fSet(_size * _size, false), energy(_size * _size, 0.0f) {
+		int width = 2 * radius + 1;
+		kernel.resize(width * width);
+		for (int dy = -radius; dy <= radius; dy++) {
+			for (int dx = -radius; dx <= radius; dx++)
+				kernel[(dy + radius) * width + dx + radius] = std::exp(-(dx * dx + dy * dy) / (2.0f * CLUSTER_SIGMA * CLUSTER_SIGMA));
+		}
+	}
+
+	bool IsSet(int index) const { return fSet[index]; }
+
+	void Toggle(int index) {
+		fSet[index] = !fSet[index];
+		float sign = fSet[index] ? 1.0f : -1.0f;
+		int px = index % size, py = index / size;
+		int width = 2 * radius + 1;
+		for (int dy = -radius; dy <= radius; dy++) {
+			int y = (py + dy) & (size - 1);
+			for (int dx = -radius; dx <= radius; dx++) {
+				int neighbor = y * size + ((px + dx) & (size - 1));
+				float weight = kernel[(dy + radius) * width + dx + radius];
+				if (previous)
+					weight *= std::exp(-std::abs((*previous)[index] - (*previous)[neighbor]) / SAMPLE_SIGMA);
+				energy[neighbor] += sign * weight;
+			}
+		}
+	}
+
+	// Set pixel with the most set pixels around it.
+	int TightestCluster() const {
+		int best = -1;
+		for (int i = 0; i < size * size; i++) {
+			if (fSet[i] && (best < 0 || energy[i] > energy[best]))
+				best = i;
+		}
+		return best;
+	}
+
+	// Unset pixel with the fewest set pixels around it.
+	int LargestVoid() const {
+		int best = -1;
+		for (int i = 0; i < size * size; i++) {
+			if (!fSet[i] && (best < 0 || energy[i] < energy[best]))
+				best = i;
+		}
+		return best;
+	}
+
+private:
+	int size;
+	int radius;
+	const std::vector<float> *previous;
+	std::vector<bool> fSet;
+	std::vector<float> energy;
+	std::vector<float> kernel;
+};
+
+}
+
+// Rank the pixels of a 'size' x 'size' torus by void-and-cluster, and return
+// the ranks as fractions in the middles of their levels.
+static std::vector<float> voidAndCluster(int size, const std::vector<float> *previous, uint64_t seed)
+{
+	int count = size * size;
+	std::vector<int> ranks(count);
+
+	// Start from a few random pixels, then move the pixel of the tightest
+	// cluster to the largest void until it stays where it is.
+	Pattern initial(size, previous);
+	RNG rng(seed, 0);
+	int initialCount = std::max(1, static_cast<int>(count * INITIAL_FRACTION));
+	for (int set = 0; set < initialCount;) {
+		int index = static_cast<int>(rng.NextUInt() % count);
+		if (!initial.IsSet(index)) {
+			initial.Toggle(index);
+			set++;
+		}
+	}
+	for (;;) {
+		int cluster = initial.TightestCluster();
+		initial.Toggle(cluster);
+		int hole = initial.LargestVoid();
+		initial.Toggle(hole);
+		if (hole == cluster)
+			break;
+	}
+
+	// The pixels of the initial pattern rank below it, the first one removed
+	// from the tightest cluster last.
+	Pattern pattern = initial;
+	for (int rank = initialCount - 1; rank >= 0; rank--) {
+		int cluster = pattern.TightestCluster();
+		pattern.Toggle(cluster);
+		ranks[cluster] = rank;
+	}
+
+	// The other pixels rank above it, filling the largest void first. Past
+	// half of the pixels this is also Ulichney's tightest cluster of unset
+	// pixels, as the set and the unset densities add up to about a constant.
+	pattern = initial;
+	for (int rank = initialCount; rank < count; rank++) {
+		int hole = pattern.LargestVoid();
+		pattern.Toggle(hole);
+		ranks[hole] = rank;
+	}
+
+	std::vector<float> fractions(count);
+	for (int i = 0; i < count; i++)
+		fractions[i] = (ranks[i] + 0.5f) / count;
+	return fractions;
+}
+
+BlueNoiseMask::BlueNoiseMask(int _size) : size(_size), mask(_size - 1), thresholds(2 * _size * _size)
+{
+	if (size <= 0 || (size & mask) != 0)
+		throw std::runtime_error("BlueNoiseMask size must be a power of two");
+
+	// The second thresholds are ranked again with the pixels whose first ones
+	// are close pushed apart, so that the pairs are spread in two dimensions
+	// as well as each one on its own (Georgiev and Fajardo, "Blue-noise
+	// Dithered Sampling").
+	std::vector<float> first = voidAndCluster(size, nullptr, 0x626c7565);
+	std::vector<float> second = voidAndCluster(size, &first, 0x6e6f6973);
+	for (int i = 0; i < size * size; i++) {
+		thresholds[2 * i] = static_cast<uint32_t>(first[i] * 4294967296.0);
+		thresholds[2 * i + 1] = static_cast<uint32_t>(second[i] * 4294967296.0);
+	}
+}
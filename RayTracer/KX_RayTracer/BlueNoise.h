@@ -0,0 +1,37 @@
+// Blue-noise threshold mask.
+// A square of pairs of thresholds whose every level set is spread evenly,
+// with no low frequencies, made by void-and-cluster (Ulichney, "The
+// void-and-cluster method for dither array generation"). It tiles the image,
+// and offsetting the samples of each pixel by its threshold turns their
+// error into blue noise across the screen, which looks less noisy than white
+// noise of the same RMSE at a few samples per pixel.
+#ifndef _BLUENOISE_H
+#define _BLUENOISE_H
+
+#include <stdint.h>
+#include <vector>
+
+class BlueNoiseMask
+{
+public:
+	// Build a 'size' x 'size' mask, the same every time. Takes O(size^4).
+	BlueNoiseMask(int size);
+
+	// Pair of thresholds of pixel (x, y), the mask repeating in both
+	// directions, as fractions of 2^32 at the middles of their levels. Each
+	// of them is blue noise, and so are the two together.
+	void Get(int x, int y, uint32_t *t1, uint32_t *t2) const {
+		const uint32_t *pair = &thresholds[2 * ((y & mask) * size + (x & mask))];
+		*t1 = pair[0];
+		*t2 = pair[1];
+	}
+
+	int Size() const { return size; }
+
+private:
+	int size;			// a power of two
+	int mask;			// size - 1
+	std::vector<uint32_t> thresholds;	// pairs, row by row
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "Camera.h"
+
+Camera::Camera(int _imgWidth, int _imgHeight)
+{
+	imgWidth = _imgWidth;
+	imgHeight = _imgHeight;
+
+	planeMinX = -10.0f;
+	planeMaxX = 10.0f;
+	planeMinY = -10.0f;
+	planeMaxY = 10.0f;
+	pixelRadiusX = (planeMaxX - planeMinX) / imgWidth / 2.0f;
+	pixelRadiusY = (planeMaxY - planeMinY) / imgHeight / 2.0f;
+
+	d = 20.0f;
+	eye = Point3f(0, 0, -20.0f);
+	filmArea = (planeMaxX - planeMinX) * (planeMaxY - planeMinY) / (d * d);
+}
+
+Ray Camera::GenerateRay(int w, int h, float u1, float u2) const
+{
+	// w and h are in image coordinate, need to convert them into the scene coordinate.
+	float x = planeMinX + (float)w / imgWidth * (planeMaxX - planeMinX) + (2 * u1 - 1) * pixelRadiusX;
+	float y = planeMaxY - (float)h / imgHeight * (planeMaxY - planeMinY) + (2 * u2 - 1) * pixelRadiusY;
+
+	return Ray(eye, Vector3f(x - eye.x, y - eye.y, d));
+}
+
+bool Camera::GetRasterPosition(const Vector3f& dir, int *w, int *h) const
+{
+	if (dir.z <= 0)
+		return false;
+
+	// Where the direction crosses the image plane.
+	float x = eye.x + dir.x / dir.z * d;
+	float y = eye.y + dir.y / dir.z * d;
+
+	float fw = (x - (planeMinX - pixelRadiusX)) / (2 * pixelRadiusX);
+	float fh = ((planeMaxY + pixelRadiusY) - y) / (2 * pixelRadiusY);
+	if (fw < 0 || fh < 0 || fw >= imgWidth || fh >= imgHeight)
+		return false;
+
+	*w = static_cast<int>(fw);
+	*h = static_cast<int>(fh);
+	return true;
+}
+
+float Camera::We(const Vector3f& dir) const
+{
+	int w, h;
+	if (!GetRasterPosition(dir, &w, &h))
+		return 0.0f;
+
+	float cos2Theta = dir.z * dir.z;
+	return 1.0f / (filmArea * cos2Theta * cos2Theta);
+}
+
+float Camera::PdfDir(const Vector3f& dir) const
+{
+	int w, h;
+	if (!GetRasterPosition(dir, &w, &h))
+		return 0.0f;
+
+	return 1.0f / (filmArea * dir.z * dir.z * dir.z);
+}
@@ -0,0 +1,51 @@
+// Pinhole camera.
+// The eye looks down +z at an image plane 'd' in front of it, which spans
+// [-10, 10] in x and y. Pixel (w, h) is the square of the image plane
+// centered at its anchor point, with h going down the image.
+#ifndef _CAMERA_H
+#define _CAMERA_H
+
+#include "Ray.h"
+#include "Utility.h"
+
+class Camera
+{
+public:
+	Camera(int _imgWidth, int _imgHeight);
+
+	// Return the ray through pixel (w, h), jittered inside the pixel by
+	// u1, u2 in [0, 1).
+	Ray GenerateRay(int w, int h, float u1, float u2) const;
+
+	// Find the pixel seen along the normalized direction 'dir' from the eye,
+	// and store it in 'w' and 'h'. Return false if it is outside the image.
+	bool GetRasterPosition(const Vector3f& dir, int *w, int *h) const;
+
+	// Importance emitted along the normalized direction 'dir' from the eye,
+	// for the image as a whole.
+	float We(const Vector3f& dir) const;
+
+	// Solid angle density of GenerateRay() picking 'dir' when the pixel is
+	// picked uniformly over the image.
+	float PdfDir(const Vector3f& dir) const;
+
+	Point3f GetEye() const { return eye; }
+
+	// Direction the camera looks at, also the normal of the image plane.
+	Vector3f GetForward() const { return Vector3f(0, 0, 1.f); }
+
+private:
+	int imgWidth;
+	int imgHeight;
+
+	float planeMinX, planeMaxX;
+	float planeMinY, planeMaxY;
+	float pixelRadiusX;		// half of a pixel's width on the image plane
+	float pixelRadiusY;		// half of a pixel's height on the image plane
+
+	float d;				// distance between the eye and the image plane
+	Point3f eye;
+	float filmArea;			// area of the image plane scaled to a distance of 1
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "EnvironmentMap.h"
+#include <cstdio>
+#include <stdexcept>
+#include "stb_image.h"
+
+EnvironmentMap::EnvironmentMap(const std::string& filename)
+{
+	int n;
+	float *data = stbi_loadf(filename.c_str(), &width, &height, &n, 3);
+	if (!data) {
+		fprintf(stderr, "EnvironmentMap - Could not open '%s'.\n", filename.c_str());
+		throw std::runtime_error("Error in load");
+	}
+
+	texels.resize(width * height);
+	for (int i = 0; i < width * height; i++)
+		texels[i] = RGBColor(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+	stbi_image_free(data);
+
+	Build();
+}
+
+EnvironmentMap::EnvironmentMap(int _width, int _height, const std::vector<RGBColor>& _texels)
+{
+	width = _width;
+	height = _height;
+	texels = _texels;
+	Build();
+}
+
+void EnvironmentMap::Build()
+{
+	// A row near the poles covers a smaller solid angle than a row near the
+	// horizon, so weigh the texels by sin(theta) as well.
+	std::vector<float> rowWeights(height);
+	std::vector<float> weights(width);
+	columns.resize(height);
+	for (int y = 0; y < height; y++) {
+		float sinTheta = sin(static_cast<float>(M_PI) * (y + 0.5f) / height);
+		float sum = 0.0f;
+		for (int x = 0; x < width; x++) {
+			weights[x] = luminance(texels[y * width + x]) * sinTheta;
+			sum += weights[x];
+		}
+		columns[y].Build(weights);
+		rowWeights[y] = sum;
+	}
+	rows.Build(rowWeights);
+}
+
+int EnvironmentMap::TexelIndex(const Vector3f& dir) const
+{
+	float u = (atan2(dir.z, dir.x) + static_cast<float>(M_PI)) * static_cast<float>(0.5 / M_PI);
+	float v = acos(std::min(std::max(dir.y, -1.0f), 1.0f)) * static_cast<float>(1 / M_PI);
+	int x = std::min(static_cast<int>(u * width), width - 1);
+	int y = std::min(static_cast<int>(v * height), height - 1);
+	return y * width + x;
+}
+
+RGBColor EnvironmentMap::Eval(const Vector3f& dir) const
+{
+	return texels[TexelIndex(dir)];
+}
+
+Vector3f EnvironmentMap::Sample(float u1, float u2, float *pdf) const
+{
+	float rowPmf, columnPmf, du, dv;
+	int y = rows.Sample(u1, &rowPmf, &dv);
+	int x = columns[y].Sample(u2, &columnPmf, &du);
+
+	// Uniform inside the texel, which has the density width * height over
+	// the unit square of (u, v).
+	float u = (x + du) / width;
+	float v = (y + dv) / height;
+	float theta = static_cast<float>(M_PI) * v;
+	float phi = static_cast<float>(2 * M_PI) * u - static_cast<float>(M_PI);
+	float sinTheta = sin(theta);
+
+	*pdf = sinTheta > 0 ? rowPmf * columnPmf * width * height / (static_cast<float>(2 * M_PI * M_PI) * sinTheta) : 0.0f;
+	return Vector3f(sinTheta * cos(phi), cos(theta), sinTheta * sin(phi));
+}
+
+float EnvironmentMap::Pdf(const Vector3f& dir) const
+{
+	float sinTheta = sqrt(std::max(0.0f, 1 - dir.y * dir.y));
+	if (sinTheta <= 0)
+		return 0.0f;
+
+	int index = TexelIndex(dir);
+	int y = index / width;
+	return rows.Pmf(y) * columns[y].Pmf(index - y * width) * width * height / (static_cast<float>(2 * M_PI * M_PI) * sinTheta);
+}
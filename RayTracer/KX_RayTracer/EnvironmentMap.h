@@ -0,0 +1,44 @@
+// Environment map.
+// Radiance arriving from infinitely far away, stored as a latitude-longitude
+// image with +y up. Directions are picked proportionally to the radiance
+// with a 2D alias table, a table over the rows and one over each row.
+#ifndef _ENVIRONMENTMAP_H
+#define _ENVIRONMENTMAP_H
+
+#include <string>
+#include <vector>
+#include "AliasTable.h"
+#include "Utility.h"
+
+class EnvironmentMap
+{
+public:
+	// Load an HDR (or any other) image with stb_image.
+	EnvironmentMap(const std::string& filename);
+	EnvironmentMap(int _width, int _height, const std::vector<RGBColor>& _texels);
+
+	// Radiance arriving from the normalized direction 'dir'.
+	RGBColor Eval(const Vector3f& dir) const;
+
+	// Pick a direction proportionally to the radiance with u1, u2 in [0, 1),
+	// and store its density per unit solid angle in 'pdf'.
+	Vector3f Sample(float u1, float u2, float *pdf) const;
+
+	// Return the density of Sample() picking the normalized direction 'dir'.
+	float Pdf(const Vector3f& dir) const;
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+
+private:
+	void Build();
+	int TexelIndex(const Vector3f& dir) const;
+
+	int width;
+	int height;
+	std::vector<RGBColor> texels;
+	AliasTable rows;					// picks a row by its total weight
+	std::vector<AliasTable> columns;	// pick a texel inside each row
+};
+
+#endif
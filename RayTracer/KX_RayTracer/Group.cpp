@@ -42,6 +42,26 @@ Vector3f Group::GetNormal(const Point3f& p) const
 	return Vector3f();
 }
 
+float Group::GetArea() const
+{
+	float area = 0.0f;
+	std::vector<const std::shared_ptr<Surface> >::const_iterator it;
+	for (it = surfaces.begin(); it != surfaces.end(); ++it) {
+		area += (*it)->GetArea();
+	}
+	return area;
+}
+
+BBox Group::GetBounds() const
+{
+	BBox bounds;
+	std::vector<const std::shared_ptr<Surface> >::const_iterator it;
+	for (it = surfaces.begin(); it != surfaces.end(); ++it) {
+		bounds = bounds.Union((*it)->GetBounds());
+	}
+	return bounds;
+}
+
 void Group::GatherLightSources(std::vector<const Surface*>& lights) const
 {
 	std::vector<const std::shared_ptr<Surface> >::const_iterator it;
@@ -60,11 +80,6 @@ void Group::SetMaterial(const std::shared_ptr<Material>& _pMaterial)
 	}
 }
 
-Point3f Group::GetLightPointInGrid(int gridNum) const
-{
-	return Point3f();
-}
-
 void Group::AddObject(const std::shared_ptr<Surface>& pObject)
 {
 	surfaces.push_back(pObject);
@@ -18,12 +18,14 @@ public:
 
 	virtual Vector3f GetNormal(const Point3f& p) const;
 
+	virtual float GetArea() const;
+
+	virtual BBox GetBounds() const;
+
 	virtual void GatherLightSources(std::vector<const Surface*>& lights) const;
 
 	virtual void SetMaterial(const std::shared_ptr<Material>& _pMaterial);
 
-	virtual Point3f GetLightPointInGrid(int gridNum) const;
-
 	void AddObject(const std::shared_ptr<Surface>& pObject);
 
 	void SetEnclosingSphere(const Point3f& _c, float _r);
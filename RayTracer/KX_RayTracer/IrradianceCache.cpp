@@ -0,0 +1,150 @@
+#include "IrradianceCache.h"
+#include <algorithm>
+
+IrradianceCache::Node::Node()
+{
+	for (int i = 0; i < 8; i++)
+		children[i] = nullptr;
+	records = nullptr;
+}
+
+IrradianceCache::IrradianceCache(const BBox& bounds, float _maxError)
+{
+	// Make the root a cube slightly larger than the scene.
+	rootCenter = bounds.Center();
+	Vector3f diagonal = bounds.Diagonal();
+	rootHalfSize = std::max(diagonal.x, std::max(diagonal.y, diagonal.z)) * 0.5f * 1.01f;
+
+	maxError = _maxError;
+	minRadius = rootHalfSize * 0.01f;
+	maxRadius = rootHalfSize * 0.25f;
+	recordCount = 0;
+}
+
+IrradianceCache::~IrradianceCache()
+{
+}
+
+// Index of the child of a node centered at 'center' that contains 'p', and
+// move 'center' to the child's center.
+static int childIndex(const Point3f& p, float childHalfSize, Point3f *center)
+{
+	int index = 0;
+	if (p.x > center->x) { index |= 1; center->x += childHalfSize; } else { center->x -= childHalfSize; }
+	if (p.y > center->y) { index |= 2; center->y += childHalfSize; } else { center->y -= childHalfSize; }
+	if (p.z > center->z) { index |= 4; center->z += childHalfSize; } else { center->z -= childHalfSize; }
+	return index;
+}
+
+void IrradianceCache::Add(const Point3f& p, const Vector3f& n, const IrradianceSample& sample, float harmonicDistance)
+{
+	// Once the pools are full, the cache stops growing.
+	Record *record = recordPool.New();
+	if (record == nullptr)
+		return;
+	record->p = p;
+	record->n = n;
+	record->sample = sample;
+
+	// Keep records from spreading over a change in irradiance faster than
+	// the translational gradient predicts.
+	float radius = harmonicDistance;
+	float e = luminance(sample.E);
+	Vector3f grad = sample.transGradient[0] * 0.2126f + sample.transGradient[1] * 0.7152f + sample.transGradient[2] * 0.0722f;
+	float gradLength = sqrt(dot(grad, grad));
+	if (gradLength > 0)
+		radius = std::min(radius, e / gradLength);
+	record->radius = std::min(std::max(radius, minRadius), maxRadius);
+
+	// Store the record in the deepest node whose size still covers the area
+	// it is valid in, creating nodes on the way as needed.
+	float validRadius = record->radius * maxError;
+	Node *node = &root;
+	Point3f center = rootCenter;
+	float halfSize = rootHalfSize;
+	while (halfSize * 0.5f >= validRadius) {
+		halfSize *= 0.5f;
+		std::atomic<Node*>& child = node->children[childIndex(p, halfSize, &center)];
+		Node *next = child.load();
+		if (next == nullptr) {
+			Node *created = nodePool.New();
+			if (created == nullptr)
+				break;				// keep the record in the deepest node there is
+			if (child.compare_exchange_strong(next, created))
+				next = created;
+			// Otherwise another thread got there first, 'next' holds its node
+			// and 'created' stays unused in the pool.
+		}
+		node = next;
+	}
+
+	Record *head = node->records.load();
+	do {
+		record->next = head;
+	} while (!node->records.compare_exchange_weak(head, record));
+
+	recordCount++;
+}
+
+bool IrradianceCache::Lookup(const Point3f& p, const Vector3f& n, RGBColor *E) const
+{
+	RGBColor sum;
+	float weightSum = 0.0f;
+	Lookup(&root, rootCenter, rootHalfSize, p, n, &sum, &weightSum);
+
+	if (weightSum <= 0.0f)
+		return false;
+
+	*E = sum * (1.0f / weightSum);
+	return true;
+}
+
+void IrradianceCache::Lookup(const Node *node, const Point3f& center, float halfSize, const Point3f& p, const Vector3f& n,
+	RGBColor *sum, float *weightSum) const
+{
+	for (const Record *record = node->records.load(); record; record = record->next) {
+		Vector3f d(record->p /*start*/, p /*end*/);
+
+		// Skip records in front of 'p', they see a different part of the scene.
+		Vector3f nAvg = (n + record->n) * 0.5f;
+		if (dot(d, nAvg) < -0.01f * record->radius)
+			continue;
+
+		float nDot = std::min(dot(n, record->n), 1.0f);
+		if (nDot <= 0)
+			continue;
+
+		float error = sqrt(dot(d, d)) / record->radius + sqrt(1.0f - nDot);
+		if (error >= maxError)
+			continue;
+
+		float weight = error > 0 ? 1.0f / error - 1.0f / maxError : 1e6f;
+
+		// Extrapolate with the gradients.
+		Vector3f rot = cross(record->n, n);
+		const IrradianceSample& s = record->sample;
+		RGBColor E(std::max(0.0f, s.E.r + dot(rot, s.rotGradient[0]) + dot(d, s.transGradient[0])),
+			std::max(0.0f, s.E.g + dot(rot, s.rotGradient[1]) + dot(d, s.transGradient[1])),
+			std::max(0.0f, s.E.b + dot(rot, s.rotGradient[2]) + dot(d, s.transGradient[2])));
+
+		*sum = *sum + E * weight;
+		*weightSum += weight;
+	}
+
+	// Records are valid up to a distance of at most the size of their node,
+	// so only the children whose bounds grown by that much contain 'p' can
+	// hold a record for it.
+	float childHalfSize = halfSize * 0.5f;
+	for (int i = 0; i < 8; i++) {
+		const Node *child = node->children[i].load();
+		if (child == nullptr)
+			continue;
+
+		Point3f childCenter(center.x + ((i & 1) ? childHalfSize : -childHalfSize),
+			center.y + ((i & 2) ? childHalfSize : -childHalfSize),
+			center.z + ((i & 4) ? childHalfSize : -childHalfSize));
+		float extent = childHalfSize * 3.0f;
+		if (fabs(p.x - childCenter.x) <= extent && fabs(p.y - childCenter.y) <= extent && fabs(p.z - childCenter.z) <= extent)
+			Lookup(child, childCenter, childHalfSize, p, n, sum, weightSum);
+	}
+}
@@ -0,0 +1,79 @@
+// World-space irradiance cache (Ward et al., "A Ray Tracing Solution for
+// Diffuse Interreflection", with the gradients of Ward and Heckbert).
+// Records are created lazily at diffuse hits and interpolated from nearby
+// ones with their rotational and translational gradients.
+//
+// The records live in an octree that every thread reads and adds to at the
+// same time without locks: nodes and records are only ever added, each with
+// a single compare-and-swap, and nothing is removed until the cache is
+// destroyed. They are carved from blocks, so that adding a record only goes
+// to the heap once in IRRADIANCE_POOL_BLOCK times.
+#ifndef _IRRADIANCECACHE_H
+#define _IRRADIANCECACHE_H
+
+#include <atomic>
+#include "BlockPool.h"
+#include "Utility.h"
+
+// Irradiance and its gradients, one gradient per color channel.
+struct IrradianceSample {
+	RGBColor E;
+	Vector3f rotGradient[3];
+	Vector3f transGradient[3];
+};
+
+class IrradianceCache
+{
+public:
+	// 'bounds' must contain every point looked up. 'maxError' is Ward's
+	// error parameter 'a', smaller values place records closer together.
+	IrradianceCache(const BBox& bounds, float _maxError);
+	~IrradianceCache();
+
+	// Interpolate the irradiance at 'p' with normal 'n' from the records
+	// nearby. Return false if no record is close enough.
+	bool Lookup(const Point3f& p, const Vector3f& n, RGBColor *E) const;
+
+	// Add a record at 'p' with normal 'n', computed from samples whose
+	// harmonic mean distance to the surfaces around is 'harmonicDistance'.
+	void Add(const Point3f& p, const Vector3f& n, const IrradianceSample& sample, float harmonicDistance);
+
+	int GetRecordCount() const { return recordCount; }
+
+	// Blocks of records and nodes taken from the heap so far.
+	int GetBlockCount() const { return recordPool.GetBlockCount() + nodePool.GetBlockCount(); }
+
+private:
+	IrradianceCache(const IrradianceCache&);
+	IrradianceCache& operator=(const IrradianceCache&);
+
+	struct Record {
+		Point3f p;
+		Vector3f n;
+		IrradianceSample sample;
+		float radius;		// harmonic mean distance, clamped
+		Record *next;		// next record in the same node
+	};
+
+	struct Node {
+		std::atomic<Node*> children[8];
+		std::atomic<Record*> records;
+
+		Node();
+	};
+
+	void Lookup(const Node *node, const Point3f& center, float halfSize, const Point3f& p, const Vector3f& n,
+		RGBColor *sum, float *weightSum) const;
+
+	BlockPool<Record, IRRADIANCE_POOL_BLOCK, IRRADIANCE_POOL_BLOCKS> recordPool;
+	BlockPool<Node, IRRADIANCE_POOL_BLOCK, IRRADIANCE_POOL_BLOCKS> nodePool;
+	Node root;
+	Point3f rootCenter;
+	float rootHalfSize;
+	float maxError;
+	float minRadius;
+	float maxRadius;
+	std::atomic<int> recordCount;
+};
+
+#endif
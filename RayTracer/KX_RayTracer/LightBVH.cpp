@@ -0,0 +1,185 @@
+#include "LightBVH.h"
+
+// cos(a - b) clamped to 1 when a < b, given the sines and cosines of a and b.
+static float cosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	if (cos_a > cos_b)
+		return 1.0f;
+	return cos_a * cos_b + sin_a * sin_b;
+}
+
+// sin(a - b) clamped to 0 when a < b, given the sines and cosines of a and b.
+static float sinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+	if (cos_a > cos_b)
+		return 0.0f;
+	return sin_a * cos_b - cos_a * sin_b;
+}
+
+static float safeSqrt(float x)
+{
+	return sqrt(std::max(0.0f, x));
+}
+
+float LightBVH::LightBounds::Importance(const Point3f& p, const Vector3f& n) const
+{
+	// Distance to the center of the bounds, clamped so that points inside the
+	// bounds do not get an unbounded importance.
+	Point3f pc = bounds.Center();
+	Vector3f wi(pc /*start*/, p /*end*/);
+	Vector3f diagonal = bounds.Diagonal();
+	float d2 = std::max(dot(wi, wi), static_cast<float>(sqrt(dot(diagonal, diagonal))) / 2);
+	wi.Normalize();
+
+	// Lights are treated as two-sided since fast shading does not check which
+	// side of a light a shading point is on.
+	float cosTheta_w = fabs(dot(normals.axis, wi));
+	float sinTheta_w = safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+	// Angle subtended by the bounds' bounding sphere as seen from 'p'.
+	float radius2 = dot(diagonal, diagonal) / 4;
+	float cosTheta_b = -1.0f;
+	if (dot(Vector3f(pc, p), Vector3f(pc, p)) > radius2)
+		cosTheta_b = safeSqrt(1 - radius2 / dot(Vector3f(pc, p), Vector3f(pc, p)));
+	float sinTheta_b = safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+	// Smallest angle between any emitter normal and any direction towards 'p'.
+	float cosTheta_o = normals.cosTheta;
+	float sinTheta_o = safeSqrt(1 - cosTheta_o * cosTheta_o);
+	float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+	float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+	float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+	if (cosThetap <= 0)
+		return 0.0f;
+
+	// Smallest angle between the shading normal and any direction towards the lights.
+	float cosTheta_i = -dot(wi, n);
+	float sinTheta_i = safeSqrt(1 - cosTheta_i * cosTheta_i);
+	float cosThetap_i = cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+	if (cosThetap_i <= 0)
+		return 0.0f;
+
+	return power * cosThetap * cosThetap_i / d2;
+}
+
+void LightBVH::Build(const LightTable& lights)
+{
+	nodes.clear();
+	lightBitTrails.assign(lights.Size(), 0);
+
+	std::vector<int> indices;
+	for (int i = 0; i < lights.Size(); i++) {
+		if (lights[i].power > 0)
+			indices.push_back(i);
+	}
+
+	if (!indices.empty())
+		BuildRecursive(lights, indices, 0, static_cast<int>(indices.size()), 0, 0);
+}
+
+int LightBVH::BuildRecursive(const LightTable& lights, std::vector<int>& indices, int begin, int end, uint32_t bitTrail, int depth)
+{
+	int nodeIndex = static_cast<int>(nodes.size());
+	nodes.push_back(Node());
+
+	if (end - begin == 1) {
+		const LightEntry& entry = lights[indices[begin]];
+		nodes[nodeIndex].lightBounds.bounds = entry.light->GetBounds();
+		nodes[nodeIndex].lightBounds.normals = entry.light->GetNormalCone();
+		nodes[nodeIndex].lightBounds.power = entry.power;
+		nodes[nodeIndex].child = -1;
+		nodes[nodeIndex].lightIndex = indices[begin];
+		lightBitTrails[indices[begin]] = bitTrail | (1u << depth);	// mark the end of the trail with a set bit
+		return nodeIndex;
+	}
+
+	// Split at the median of the light centers along the axis where they spread most.
+	BBox centers;
+	for (int i = begin; i < end; i++)
+		centers = centers.Union(lights[indices[i]].light->GetBounds().Center());
+	int axis = centers.MaxExtent();
+	int mid = (begin + end) / 2;
+	std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+		[&lights, axis](int a, int b) {
+			Point3f pa = lights[a].light->GetBounds().Center();
+			Point3f pb = lights[b].light->GetBounds().Center();
+			return (axis == 0 ? pa.x < pb.x : axis == 1 ? pa.y < pb.y : pa.z < pb.z);
+		});
+
+	// Deeper trees than 31 levels would not fit in the bit trails, and cannot
+	// happen with a median split unless there are billions of lights.
+	int first = BuildRecursive(lights, indices, begin, mid, bitTrail, depth + 1);
+	int second = BuildRecursive(lights, indices, mid, end, bitTrail | (1u << depth), depth + 1);
+
+	LightBounds& lb = nodes[nodeIndex].lightBounds;
+	lb.bounds = nodes[first].lightBounds.bounds.Union(nodes[second].lightBounds.bounds);
+	lb.normals = DirectionCone::Union(nodes[first].lightBounds.normals, nodes[second].lightBounds.normals);
+	lb.power = nodes[first].lightBounds.power + nodes[second].lightBounds.power;
+	nodes[nodeIndex].child = second;
+	nodes[nodeIndex].lightIndex = -1;
+
+	return nodeIndex;
+}
+
+int LightBVH::Sample(const Point3f& p, const Vector3f& n, float u, float *pmf) const
+{
+	if (nodes.empty())
+		return -1;
+
+	int nodeIndex = 0;
+	float prob = 1.0f;
+
+	while (nodes[nodeIndex].lightIndex < 0) {
+		int first = nodeIndex + 1;
+		int second = nodes[nodeIndex].child;
+		float i0 = nodes[first].lightBounds.Importance(p, n);
+		float i1 = nodes[second].lightBounds.Importance(p, n);
+		if (i0 == 0 && i1 == 0)
+			return -1;
+
+		// Pick a child proportionally to its importance, and rescale 'u' so it
+		// can be reused for the next level.
+		float p0 = i0 / (i0 + i1);
+		if (u < p0) {
+			nodeIndex = first;
+			u = std::min(u / p0, 0.99999994f);
+			prob *= p0;
+		}
+		else {
+			nodeIndex = second;
+			u = std::min((u - p0) / (1 - p0), 0.99999994f);
+			prob *= 1 - p0;
+		}
+	}
+
+	if (pmf)
+		*pmf = prob;
+	return nodes[nodeIndex].lightIndex;
+}
+
+float LightBVH::Pmf(const Point3f& p, const Vector3f& n, int index) const
+{
+	if (nodes.empty() || lightBitTrails[index] == 0)
+		return 0.0f;
+
+	// Follow the light's bit trail down from the root, until only the end
+	// marker is left.
+	uint32_t bitTrail = lightBitTrails[index];
+	int nodeIndex = 0;
+	float prob = 1.0f;
+
+	while (bitTrail != 1) {
+		int first = nodeIndex + 1;
+		int second = nodes[nodeIndex].child;
+		float i0 = nodes[first].lightBounds.Importance(p, n);
+		float i1 = nodes[second].lightBounds.Importance(p, n);
+		if (i0 == 0 && i1 == 0)
+			return 0.0f;
+
+		nodeIndex = (bitTrail & 1) ? second : first;
+		prob *= ((bitTrail & 1) ? i1 : i0) / (i0 + i1);
+		bitTrail >>= 1;
+	}
+
+	return prob;
+}
@@ -0,0 +1,51 @@
+// Bounding volume hierarchy over the light sources.
+// Each node bounds the position, orientation and power of the lights below
+// it, so a light can be picked proportionally to an estimate of its
+// contribution to a shading point by walking down a single path of the tree.
+#ifndef _LIGHTBVH_H
+#define _LIGHTBVH_H
+
+#include <stdint.h>
+#include <vector>
+#include "LightTable.h"
+
+class LightBVH
+{
+public:
+	void Build(const LightTable& lights);
+
+	bool empty() const { return nodes.empty(); }
+
+	// Pick a light for the shading point 'p' with normal 'n' with 'u' in
+	// [0, 1), and store the probability of picking it in 'pmf'. Return the
+	// light's index in the light table, or -1 if no light can contribute.
+	int Sample(const Point3f& p, const Vector3f& n, float u, float *pmf) const;
+
+	// Return the probability that Sample() picks the light 'index' for the
+	// shading point 'p' with normal 'n'.
+	float Pmf(const Point3f& p, const Vector3f& n, int index) const;
+
+private:
+	struct LightBounds {
+		BBox bounds;
+		DirectionCone normals;
+		float power;
+
+		// Conservative estimate of how much the lights inside can contribute
+		// to the shading point 'p' with normal 'n'.
+		float Importance(const Point3f& p, const Vector3f& n) const;
+	};
+
+	struct Node {
+		LightBounds lightBounds;
+		int child;		// index of the second child, the first one follows this node
+		int lightIndex;	// index in the light table for leaves, -1 otherwise
+	};
+
+	int BuildRecursive(const LightTable& lights, std::vector<int>& indices, int begin, int end, uint32_t bitTrail, int depth);
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> lightBitTrails;	// path from the root to each light, one bit per level
+};
+
+#endif
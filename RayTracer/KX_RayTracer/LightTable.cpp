@@ -0,0 +1,33 @@
+#include "LightTable.h"
+
+void LightTable::Build(const Surface& root)
+{
+	std::vector<const Surface*> lights;
+	root.GatherLightSources(lights);
+
+	entries.clear();
+	indices.clear();
+	totalPower = 0.0f;
+
+	std::vector<float> weights;
+	std::vector<const Surface*>::const_iterator it;
+	for (it = lights.begin(); it != lights.end(); ++it) {
+		LightEntry entry;
+		entry.light = *it;
+		entry.area = (*it)->GetArea();
+		entry.power = entry.area * static_cast<float>(M_PI) * luminance((*it)->GetMaterialRecord().emissionColor);
+
+		indices[entry.light] = static_cast<int>(entries.size());
+		entries.push_back(entry);
+		weights.push_back(entry.power);
+		totalPower += entry.power;
+	}
+
+	aliases.Build(weights);
+}
+
+int LightTable::IndexOf(const Surface *light) const
+{
+	std::unordered_map<const Surface*, int>::const_iterator it = indices.find(light);
+	return it == indices.end() ? -1 : it->second;
+}
@@ -0,0 +1,45 @@
+// Flat table of the light sources in a scene.
+// Built once before rendering, so shading does not need to walk the scene
+// graph to find the lights.
+#ifndef _LIGHTTABLE_H
+#define _LIGHTTABLE_H
+
+#include <unordered_map>
+#include <vector>
+#include "AliasTable.h"
+#include "Surface.h"
+
+struct LightEntry {
+	const Surface *light;
+	float area;
+	float power;	// emitted luminous power, area * pi * luminance(emission)
+};
+
+class LightTable
+{
+public:
+	void Build(const Surface& root);
+
+	int Size() const { return static_cast<int>(entries.size()); }
+
+	const LightEntry& operator[](int i) const { return entries[i]; }
+
+	// Pick a light proportionally to its power with 'u' in [0, 1), and store
+	// the probability of picking it in 'pmf'.
+	int Sample(float u, float *pmf) const { return aliases.Sample(u, pmf); }
+
+	float Pmf(int index) const { return aliases.Pmf(index); }
+
+	float GetTotalPower() const { return totalPower; }
+
+	// Return the index of 'light' in the table, or -1 if it is not a light.
+	int IndexOf(const Surface *light) const;
+
+private:
+	std::vector<LightEntry> entries;
+	std::unordered_map<const Surface*, int> indices;
+	AliasTable aliases;
+	float totalPower;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "MaterialTable.h"
+#include <stdexcept>
+
+std::vector<std::shared_ptr<Material> > MaterialTable::materials;
+std::map<const Material*, uint16_t> MaterialTable::indices;
+std::vector<MaterialRecord> MaterialTable::records;
+
+uint16_t MaterialTable::Intern(const std::shared_ptr<Material>& pMaterial)
+{
+	if (!pMaterial)
+		return NO_MATERIAL;
+
+	std::map<const Material*, uint16_t>::const_iterator it = indices.find(pMaterial.get());
+	if (it != indices.end())
+		return it->second;
+
+	if (materials.size() >= NO_MATERIAL)
+		throw std::runtime_error("MaterialTable is full");
+
+	uint16_t index = static_cast<uint16_t>(materials.size());
+	materials.push_back(pMaterial);
+	indices[pMaterial.get()] = index;
+	return index;
+}
+
+void MaterialTable::Freeze()
+{
+	records.resize(materials.size());
+	for (size_t i = 0; i < materials.size(); i++) {
+		static_cast<Material&>(records[i]) = *materials[i];
+		records[i].fIsLight = !(materials[i]->emissionColor == RGBColor());
+	}
+}
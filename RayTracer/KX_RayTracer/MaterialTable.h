@@ -0,0 +1,42 @@
+// Flat table of all the materials in use.
+// Surfaces store a small index into the table instead of a shared pointer,
+// so looking up a material while tracing is a plain array access, without
+// any reference counting shared between threads.
+#ifndef _MATERIALTABLE_H
+#define _MATERIALTABLE_H
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include "Material.h"
+
+const uint16_t NO_MATERIAL = 0xFFFF;
+
+// A copy of a material, with the flags the tracing code needs precomputed.
+struct MaterialRecord : public Material {
+	bool fIsLight;
+};
+
+class MaterialTable
+{
+public:
+	// Return the index of 'pMaterial', adding it to the table if it is new.
+	static uint16_t Intern(const std::shared_ptr<Material>& pMaterial);
+
+	// Copy all the materials into the flat table. Must be called after the
+	// scene is set up and before rendering, later changes to the materials
+	// are not seen until it is called again.
+	static void Freeze();
+
+	static const MaterialRecord& Get(uint16_t index) { return records[index]; }
+
+	static std::shared_ptr<Material> GetShared(uint16_t index) { return materials[index]; }
+
+private:
+	static std::vector<std::shared_ptr<Material> > materials;
+	static std::map<const Material*, uint16_t> indices;
+	static std::vector<MaterialRecord> records;
+};
+
+#endif
@@ -0,0 +1,364 @@
+#include "PathGuide.h"
+
+// Quadrants holding more than this fraction of a D-tree's radiance are
+// subdivided.
+static const float DTREE_SPLIT_THRESHOLD = 0.05f;
+static const int DTREE_MAX_DEPTH = 10;
+
+// Quadtrees learned from fewer records than this are too noisy to sample.
+static const int DTREE_MIN_RECORDS = 128;
+
+// Cells are split once they record more than this many samples, times the
+// square root of 2^iteration as the passes double in size.
+static const int STREE_SPLIT_SAMPLES = 4000;
+
+// Map a unit direction to the square and back, keeping areas proportional.
+static void directionToSquare(const Vector3f& dir, float *x, float *y)
+{
+	float cosTheta = std::min(std::max(dir.z, -1.0f), 1.0f);
+	float phi = atan2(dir.y, dir.x);
+	if (phi < 0)
+		phi += static_cast<float>(2 * M_PI);
+
+	*x = std::min((cosTheta + 1) * 0.5f, 0.99999f);
+	*y = std::min(phi / static_cast<float>(2 * M_PI), 0.99999f);
+}
+
+static Vector3f squareToDirection(float x, float y)
+{
+	float cosTheta = 2 * x - 1;
+	float sinTheta = sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+	float phi = static_cast<float>(2 * M_PI) * y;
+	return Vector3f(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+DTree::Node::Node()
+{
+	for (int i = 0; i < 4; i++) {
+		sum[i].store(0, std::memory_order_relaxed);
+		children[i] = 0;
+	}
+}
+
+DTree::Node::Node(const Node& node)
+{
+	*this = node;
+}
+
+DTree::Node& DTree::Node::operator=(const Node& node)
+{
+	for (int i = 0; i < 4; i++) {
+		sum[i].store(node.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		children[i] = node.children[i];
+	}
+	return *this;
+}
+
+float DTree::Node::GetTotal() const
+{
+	return fromFixedPoint(sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed) +
+		sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed));
+}
+
+DTree::DTree() : nodes(1)
+{
+}
+
+float DTree::GetTotal() const
+{
+	return nodes[0].GetTotal();
+}
+
+// Quadrants are numbered 0 to 3 with bit 0 for the upper half in x and
+// bit 1 for the upper half in y.
+void DTree::Record(float x, float y, float value)
+{
+	int index = 0;
+	for (;;) {
+		int quadrant = (x >= 0.5f ? 1 : 0) | (y >= 0.5f ? 2 : 0);
+		atomicAdd(nodes[index].sum[quadrant], value);
+		if (nodes[index].children[quadrant] == 0)
+			return;
+
+		index = nodes[index].children[quadrant];
+		x = x >= 0.5f ? 2 * x - 1 : 2 * x;
+		y = y >= 0.5f ? 2 * y - 1 : 2 * y;
+	}
+}
+
+void DTree::Sample(float u1, float u2, float *x, float *y, float *pdf) const
+{
+	float originX = 0.0f, originY = 0.0f;
+	float size = 1.0f;
+	float density = 1.0f;
+	int index = 0;
+
+	for (;;) {
+		const Node& node = nodes[index];
+		float s[4];
+		for (int i = 0; i < 4; i++)
+			s[i] = fromFixedPoint(node.sum[i].load(std::memory_order_relaxed));
+		float total = s[0] + s[1] + s[2] + s[3];
+
+		int quadrant;
+		if (total <= 0) {
+			// Nothing recorded below here, sample uniformly.
+			quadrant = (u1 >= 0.5f ? 1 : 0) | (u2 >= 0.5f ? 2 : 0);
+			u1 = u1 >= 0.5f ? 2 * u1 - 1 : 2 * u1;
+			u2 = u2 >= 0.5f ? 2 * u2 - 1 : 2 * u2;
+		}
+		else {
+			// Pick the half in x, then the half in y given x.
+			float pLeft = (s[0] + s[2]) / total;
+			int bitX;
+			if (u1 < pLeft) {
+				bitX = 0;
+				u1 = u1 / pLeft;
+			}
+			else {
+				bitX = 1;
+				u1 = (u1 - pLeft) / (1 - pLeft);
+			}
+			float pBottom = s[bitX] / (s[bitX] + s[bitX | 2]);
+			int bitY;
+			if (u2 < pBottom) {
+				bitY = 0;
+				u2 = u2 / pBottom;
+			}
+			else {
+				bitY = 2;
+				u2 = (u2 - pBottom) / (1 - pBottom);
+			}
+			quadrant = bitX | bitY;
+			density *= 4 * s[quadrant] / total;
+		}
+
+		u1 = std::min(u1, 0.99999f);
+		u2 = std::min(u2, 0.99999f);
+		size *= 0.5f;
+		if (quadrant & 1) originX += size;
+		if (quadrant & 2) originY += size;
+
+		if (node.children[quadrant] == 0) {
+			*x = originX + u1 * size;
+			*y = originY + u2 * size;
+			*pdf = density;
+			return;
+		}
+		index = node.children[quadrant];
+	}
+}
+
+float DTree::Pdf(float x, float y) const
+{
+	float density = 1.0f;
+	int index = 0;
+
+	for (;;) {
+		const Node& node = nodes[index];
+		float total = node.GetTotal();
+		if (total <= 0)
+			return density;
+
+		int quadrant = (x >= 0.5f ? 1 : 0) | (y >= 0.5f ? 2 : 0);
+		density *= 4 * fromFixedPoint(node.sum[quadrant].load(std::memory_order_relaxed)) / total;
+		if (node.children[quadrant] == 0 || density == 0)
+			return density;
+
+		index = node.children[quadrant];
+		x = x >= 0.5f ? 2 * x - 1 : 2 * x;
+		y = y >= 0.5f ? 2 * y - 1 : 2 * y;
+	}
+}
+
+DTree DTree::Refine(float threshold) const
+{
+	DTree out;
+	float total = GetTotal();
+	if (total > 0)
+		Refine(nodes[0], total, total, threshold, 0, &out, 0);
+	return out;
+}
+
+void DTree::Refine(const Node& node, float nodeSum, float total, float threshold, int depth, DTree *out, int outIndex) const
+{
+	if (depth >= DTREE_MAX_DEPTH)
+		return;
+
+	for (int i = 0; i < 4; i++) {
+		// Quadrants without a child spread their sum evenly below them.
+		float quadrantSum = node.GetTotal() > 0 ? fromFixedPoint(node.sum[i].load(std::memory_order_relaxed)) : nodeSum * 0.25f;
+		if (quadrantSum <= total * threshold)
+			continue;
+
+		int child = static_cast<int>(out->nodes.size());
+		out->nodes.push_back(Node());
+		out->nodes[outIndex].children[i] = child;
+
+		if (node.children[i] != 0)
+			Refine(nodes[node.children[i]], quadrantSum, total, threshold, depth + 1, out, child);
+		else
+			Refine(Node(), quadrantSum, total, threshold, depth + 1, out, child);
+	}
+}
+
+PathGuide::Cell::Cell()
+{
+	for (int slot = 0; slot < 6; slot++) {
+		samplingRecords[slot] = 0;
+		buildingRecords[slot] = 0;
+	}
+	samples = 0;
+}
+
+PathGuide::PathGuide(const BBox& _bounds)
+{
+	// Grow the bounds slightly so that points on the walls fall inside.
+	Vector3f margin = _bounds.Diagonal() * 0.01f;
+	bounds = _bounds.Union(_bounds.pMin + margin * -1).Union(_bounds.pMax + margin);
+
+	Node root;
+	root.axis = 0;
+	root.children[0] = root.children[1] = 0;
+	root.cell = 0;
+	nodes.push_back(root);
+
+	cells.push_back(std::unique_ptr<Cell>(new Cell()));
+	iteration = 0;
+}
+
+int PathGuide::FindCell(const Point3f& p) const
+{
+	Vector3f diagonal = bounds.Diagonal();
+	float pos[3] = {
+		(p.x - bounds.pMin.x) / diagonal.x,
+		(p.y - bounds.pMin.y) / diagonal.y,
+		(p.z - bounds.pMin.z) / diagonal.z,
+	};
+
+	int index = 0;
+	while (nodes[index].children[0] != 0) {
+		float& c = pos[nodes[index].axis];
+		if (c < 0.5f) {
+			c = 2 * c;
+			index = nodes[index].children[0];
+		}
+		else {
+			c = 2 * c - 1;
+			index = nodes[index].children[1];
+		}
+	}
+	return nodes[index].cell;
+}
+
+int PathGuide::NormalSlot(const Vector3f& n)
+{
+	float ax = fabs(n.x), ay = fabs(n.y), az = fabs(n.z);
+	if (ax >= ay && ax >= az)
+		return n.x > 0 ? 0 : 1;
+	if (ay >= az)
+		return n.y > 0 ? 2 : 3;
+	return n.z > 0 ? 4 : 5;
+}
+
+bool PathGuide::fCanSample(const Point3f& p, const Vector3f& n) const
+{
+	const Cell& cell = *cells[FindCell(p)];
+	int slot = NormalSlot(n);
+	return cell.samplingRecords[slot] >= DTREE_MIN_RECORDS && cell.sampling[slot].GetTotal() > 0;
+}
+
+Vector3f PathGuide::Sample(const Point3f& p, const Vector3f& n, float u1, float u2, float *pdf) const
+{
+	float x, y, squarePdf;
+	cells[FindCell(p)]->sampling[NormalSlot(n)].Sample(u1, u2, &x, &y, &squarePdf);
+	*pdf = squarePdf / static_cast<float>(4 * M_PI);
+	return squareToDirection(x, y);
+}
+
+float PathGuide::Pdf(const Point3f& p, const Vector3f& n, const Vector3f& dir) const
+{
+	float x, y;
+	directionToSquare(dir, &x, &y);
+	return cells[FindCell(p)]->sampling[NormalSlot(n)].Pdf(x, y) / static_cast<float>(4 * M_PI);
+}
+
+void PathGuide::Record(const Point3f& p, const Vector3f& n, const Vector3f& dir, float radiance, float pdf)
+{
+	if (pdf <= 0)
+		return;
+
+	// Samples that found no light still count, they tell that there is
+	// little light in their direction.
+	Cell& cell = *cells[FindCell(p)];
+	int slot = NormalSlot(n);
+	cell.samples++;
+	cell.buildingRecords[slot]++;
+	if (!(radiance > 0))
+		return;
+
+	float x, y;
+	directionToSquare(dir, &x, &y);
+	cell.building[slot].Record(x, y, radiance * std::max(dot(dir, n), 0.0f) / pdf);
+}
+
+void PathGuide::Refine()
+{
+	// Split the cells that recorded enough samples, handing a copy of the
+	// directional distributions to both halves. Each half is taken to have
+	// recorded half of the samples and half of the records of every
+	// distribution, and is split again further down the loop while that is
+	// still too many samples. Only the shape of a distribution is sampled, so
+	// its sums need not be halved.
+	int splitSamples = static_cast<int>(STREE_SPLIT_SAMPLES * sqrt(pow(2.0f, static_cast<float>(iteration))));
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].children[0] != 0)
+			continue;
+
+		Cell& cell = *cells[nodes[i].cell];
+		if (cell.samples <= splitSamples)
+			continue;
+
+		for (int c = 0; c < 2; c++) {
+			Node child;
+			child.axis = (nodes[i].axis + 1) % 3;
+			child.children[0] = child.children[1] = 0;
+			if (c == 0) {
+				child.cell = nodes[i].cell;
+			}
+			else {
+				child.cell = static_cast<int>(cells.size());
+				Cell *copy = new Cell();
+				copy->samples = cell.samples / 2;
+				for (int slot = 0; slot < 6; slot++) {
+					copy->sampling[slot] = cell.sampling[slot];
+					copy->building[slot] = cell.building[slot];
+					copy->samplingRecords[slot] = cell.samplingRecords[slot];
+					copy->buildingRecords[slot] = cell.buildingRecords[slot] / 2;
+				}
+				cells.push_back(std::unique_ptr<Cell>(copy));
+			}
+			nodes[i].children[c] = static_cast<int>(nodes.size());
+			nodes.push_back(child);
+		}
+		cell.samples = cell.samples / 2;
+		for (int slot = 0; slot < 6; slot++)
+			cell.buildingRecords[slot] = cell.buildingRecords[slot] / 2;
+	}
+
+	// Sample from what was recorded, and record at a resolution adapted to it.
+	for (size_t i = 0; i < cells.size(); i++) {
+		Cell& cell = *cells[i];
+		for (int slot = 0; slot < 6; slot++) {
+			if (cell.building[slot].GetTotal() > 0) {
+				cell.sampling[slot] = cell.building[slot];
+				cell.samplingRecords[slot] = cell.buildingRecords[slot];
+				cell.building[slot] = cell.building[slot].Refine(DTREE_SPLIT_THRESHOLD);
+			}
+			cell.buildingRecords[slot] = 0;
+		}
+		cell.samples = 0;
+	}
+
+	iteration++;
+}
@@ -0,0 +1,117 @@
+// Online path guiding (Müller et al., "Practical Path Guiding for Efficient
+// Light-Transport Simulation").
+// A binary tree over the scene splits space into cells, and every cell
+// holds quadtrees over the sphere of directions that learn where the light
+// a diffuse surface reflects comes from: the incident radiance times the
+// cosine to the normal. Each cell keeps one quadtree per dominant axis of
+// the surface normal, so that the walls meeting in a cell do not learn from
+// each other's light, which lies below their own horizon. Each training
+// pass samples from the distributions learned by the previous pass while
+// recording into new ones, and Refine() swaps them between passes.
+// It does not pay off yet: on the indoor scene it only gains a few percent
+// with many samples, and below some hundred samples per pixel of a small
+// image it makes the image noisier than cosine sampling alone.
+#ifndef _PATHGUIDE_H
+#define _PATHGUIDE_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Utility.h"
+
+// Quadtree over the square [0, 1)^2, which maps to the sphere of directions
+// through cos(theta) and phi. Each node stores the radiance recorded in its
+// four quadrants, and a quadrant either is a leaf or has a child node.
+class DTree
+{
+public:
+	DTree();
+
+	void Record(float x, float y, float value);
+
+	// Sample a point of the square proportionally to the recorded radiance,
+	// and return its density with respect to the square's area.
+	void Sample(float u1, float u2, float *x, float *y, float *pdf) const;
+
+	float Pdf(float x, float y) const;
+
+	float GetTotal() const;
+
+	// Return a tree with zero sums that subdivides the quadrants that hold
+	// more than 'threshold' of the total, and merges the others.
+	DTree Refine(float threshold) const;
+
+private:
+	struct Node {
+		std::atomic<long long> sum[4];	// in fixed point, so that the order of the records does not matter
+		int children[4];	// 0 when the quadrant is a leaf, the root is never a child
+
+		Node();
+		Node(const Node& node);
+		Node& operator=(const Node& node);
+		float GetTotal() const;
+	};
+
+	void Refine(const Node& node, float nodeSum, float total, float threshold, int depth, DTree *out, int outIndex) const;
+
+	std::vector<Node> nodes;
+};
+
+class PathGuide
+{
+public:
+	PathGuide(const BBox& bounds);
+
+	// Whether there is a learned distribution to sample from at 'p' with
+	// normal 'n'.
+	bool fCanSample(const Point3f& p, const Vector3f& n) const;
+
+	// Sample a direction at 'p' and store its solid angle density in 'pdf'.
+	Vector3f Sample(const Point3f& p, const Vector3f& n, float u1, float u2, float *pdf) const;
+
+	// Solid angle density of Sample() picking 'dir' at 'p'.
+	float Pdf(const Point3f& p, const Vector3f& n, const Vector3f& dir) const;
+
+	// Record the radiance 'radiance' arriving at 'p' from 'dir', which was
+	// sampled with the density 'pdf', weighted by the cosine to 'n'. Safe to
+	// call from several threads.
+	void Record(const Point3f& p, const Vector3f& n, const Vector3f& dir, float radiance, float pdf);
+
+	// Called between passes: split the busy cells and make the distributions
+	// recorded during the pass the ones to sample from.
+	void Refine();
+
+	int GetCellCount() const { return static_cast<int>(cells.size()); }
+
+private:
+	PathGuide(const PathGuide&);
+	PathGuide& operator=(const PathGuide&);
+
+	struct Cell {
+		DTree sampling[6];				// indexed by NormalSlot()
+		DTree building[6];
+		int samplingRecords[6];			// records 'sampling' was learned from
+		std::atomic<int> buildingRecords[6];
+		std::atomic<int> samples;
+
+		Cell();
+	};
+
+	struct Node {
+		int axis;
+		int children[2];	// 0 for a leaf, the root is never a child
+		int cell;			// index in 'cells' for a leaf
+	};
+
+	int FindCell(const Point3f& p) const;
+
+	// Index of the quadtree of a cell used for surfaces with normal 'n'.
+	static int NormalSlot(const Vector3f& n);
+
+	BBox bounds;
+	std::vector<Node> nodes;
+	std::vector<std::unique_ptr<Cell> > cells;
+	int iteration;
+};
+
+#endif
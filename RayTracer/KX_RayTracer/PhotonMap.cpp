@@ -0,0 +1,73 @@
+#include "PhotonMap.h"
+#include <algorithm>
+
+static float coordinate(const Point3f& p, int axis)
+{
+	return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+}
+
+void PhotonMap::Build()
+{
+	Build(0, Size());
+}
+
+void PhotonMap::Build(int begin, int end)
+{
+	if (end - begin <= 1) {
+		if (begin < end)
+			photons[begin].axis = 0;
+		return;
+	}
+
+	BBox bounds;
+	for (int i = begin; i < end; i++)
+		bounds = bounds.Union(photons[i].p);
+	int axis = bounds.MaxExtent();
+
+	int mid = (begin + end) / 2;
+	std::nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end,
+		[axis](const Photon& a, const Photon& b) {
+		return coordinate(a.p, axis) < coordinate(b.p, axis);
+	});
+	photons[mid].axis = static_cast<char>(axis);
+
+	Build(begin, mid);
+	Build(mid + 1, end);
+}
+
+RGBColor PhotonMap::Gather(const Point3f& p, const Vector3f& n, float radius) const
+{
+	RGBColor sum;
+	Gather(0, Size(), p, n, radius * radius, &sum);
+	return sum;
+}
+
+void PhotonMap::Gather(int begin, int end, const Point3f& p, const Vector3f& n, float radius2, RGBColor *sum) const
+{
+	if (begin >= end)
+		return;
+
+	int mid = (begin + end) / 2;
+	const Photon& photon = photons[mid];
+
+	Vector3f d(p /*start*/, photon.p /*end*/);
+	if (dot(d, d) <= radius2 && dot(photon.wi, n) > 0)
+		*sum = *sum + photon.power;
+
+	if (end - begin == 1)
+		return;
+
+	// Signed distance from the splitting plane, positive on the upper side.
+	float delta = d[photon.axis];
+	if (delta > 0) {
+		// The node is above p, so the lower half is closer.
+		Gather(begin, mid, p, n, radius2, sum);
+		if (delta * delta <= radius2)
+			Gather(mid + 1, end, p, n, radius2, sum);
+	}
+	else {
+		Gather(mid + 1, end, p, n, radius2, sum);
+		if (delta * delta <= radius2)
+			Gather(begin, mid, p, n, radius2, sum);
+	}
+}
@@ -0,0 +1,42 @@
+// Photons stored in a balanced kd-tree for density estimation.
+// The tree is kept implicitly in the photon array: the photon in the middle
+// of a range splits it along 'axis', the halves on each side are its
+// children, so no node storage or pointers are needed.
+#ifndef _PHOTONMAP_H
+#define _PHOTONMAP_H
+
+#include <vector>
+#include "Utility.h"
+
+struct Photon {
+	Point3f p;
+	Vector3f wi;		// unit direction the photon arrived from
+	RGBColor power;
+	char axis;			// split axis of the kd-tree node
+};
+
+class PhotonMap
+{
+public:
+	void Clear() { photons.clear(); }
+
+	void Add(const std::vector<Photon>& _photons) { photons.insert(photons.end(), _photons.begin(), _photons.end()); }
+
+	// Balance the kd-tree. Must be called after the last Add() and before
+	// gathering.
+	void Build();
+
+	int Size() const { return static_cast<int>(photons.size()); }
+
+	// Sum the power of the photons within 'radius' of 'p' that arrived on the
+	// side of the surface 'n' faces.
+	RGBColor Gather(const Point3f& p, const Vector3f& n, float radius) const;
+
+private:
+	void Build(int begin, int end);
+	void Gather(int begin, int end, const Point3f& p, const Vector3f& n, float radius2, RGBColor *sum) const;
+
+	std::vector<Photon> photons;
+};
+
+#endif
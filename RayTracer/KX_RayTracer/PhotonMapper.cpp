@@ -0,0 +1,168 @@
+#include "PhotonMapper.h"
+#include "Sampler.h"
+#include <omp.h>
+
+PhotonMapper::PhotonMapper(const Scene& _scene, const Camera& _camera) : scene(_scene), camera(_camera)
+{
+	emitted = 0;
+}
+
+void PhotonMapper::EmitPhotons(int count, unsigned long long seed)
+{
+	photonMap.Clear();
+
+	// Every photon draws from a stream of its own, and the static schedule
+	// hands out the photons to the threads in order, so that adding their
+	// photons in the order of the threads gives the same map whatever the
+	// number of threads.
+	std::vector<std::vector<Photon> > threadPhotons(omp_get_max_threads());
+	#pragma omp parallel
+	{
+	ThreadContext ctx;
+	std::vector<Photon>& photons = threadPhotons[omp_get_thread_num()];
+
+	#pragma omp for schedule(static)
+	for (int i = 0; i < count; i++) {
+		ctx.rng.Seed(seed, i);
+		TracePhoton(ctx, &photons);
+	}
+	}
+
+	for (size_t i = 0; i < threadPhotons.size(); i++)
+		photonMap.Add(threadPhotons[i]);
+
+	emitted = count;
+	photonMap.Build();
+}
+
+float PhotonMapper::GetPassRadius(float radius, int pass)
+{
+	// r(i+1)^2 = r(i)^2 * (i + alpha) / (i + 1)
+	float radius2 = radius * radius;
+	for (int i = 1; i <= pass; i++)
+		radius2 *= (i + PHOTON_ALPHA) / (i + 1);
+	return sqrt(radius2);
+}
+
+void PhotonMapper::TracePhoton(ThreadContext& ctx, std::vector<Photon> *photons) const
+{
+	const LightTable& lights = scene.GetLights();
+	if (lights.Size() == 0)
+		return;
+
+	// Pick a light by power and a point on it, then a cosine-weighted
+	// direction on its emitting side.
+	float pmf;
+	const LightEntry& entry = lights[lights.Sample(ctx.rng.NextFloat(), &pmf)];
+	Point3f lp;
+	Vector3f ln;
+	if (!entry.light->SamplePoint(ctx.rng.NextFloat(), ctx.rng.NextFloat(), &lp, &ln))
+		return;
+
+	RGBColor power = entry.light->GetMaterialRecord().emissionColor * static_cast<float>(M_PI * entry.area / pmf);
+	Ray ray(lp, sampleCosineHemisphere(ln, ctx.rng.NextFloat(), ctx.rng.NextFloat()));
+
+	for (int depth = 0; depth < maxPathDepth; depth++) {
+		float t;
+		Surface *s = nullptr;
+		Vector3f normal;
+		ctx.segments++;
+
+		if (!scene.GetRoot().Hit(ray, RAY_T0, RAY_T1, &t, &s, &normal) || s == nullptr || !s->fHasMaterial())
+			return;
+
+		const MaterialRecord& material = s->GetMaterialRecord();
+		Point3f hitPoint = ray.origin + ray.direction * t;
+		normal.Normalize();
+		bool fOutSideIn = dot(normal, ray.direction) < 0;
+		Vector3f nf = fOutSideIn ? normal : normal * -1;	// facing the incoming ray
+		Vector3f dir;
+
+		if (material.reflType == Type::DIFF) {
+			// Direct lighting is sampled from the lights, so only photons that
+			// bounced at least once are stored.
+			if (depth > 0) {
+				Photon photon;
+				photon.p = hitPoint;
+				photon.wi = ray.direction * -1;
+				photon.power = power;
+				photon.axis = 0;
+				photons->push_back(photon);
+			}
+			dir = sampleCosineHemisphere(nf, ctx.rng.NextFloat(), ctx.rng.NextFloat());
+		}
+		else {
+			dir = ray.direction - nf * 2.0f * dot(ray.direction, nf);
+			if (material.reflType == Type::REFR) {
+				float ni = fOutSideIn ? material.extrRefrIndex : material.refrIndex;
+				float nt = fOutSideIn ? material.refrIndex : material.extrRefrIndex;
+				Vector3f refrDir;
+				if (ctx.rng.NextFloat() >= refractDielectric(ray.direction, nf, ni, nt, &refrDir))
+					dir = refrDir;
+			}
+		}
+
+		// Keep the photon power constant where possible, so that photons in
+		// the map have similar weights.
+		const RGBColor& albedo = material.materialColor;
+		float survival = std::min(std::max(albedo.r, std::max(albedo.g, albedo.b)), 1.0f);
+		if (survival <= 0 || ctx.rng.NextFloat() >= survival)
+			return;
+		power = power * albedo * (1.0f / survival);
+
+		ray = Ray(hitPoint, dir);
+	}
+}
+
+RGBColor PhotonMapper::Trace(ThreadContext& ctx, int w, int h, float radius) const
+{
+	float u1, u2;
+	ctx.sampler->Get2D(&u1, &u2);
+	Ray ray = camera.GenerateRay(w, h, u1, u2);
+	RGBColor beta(1.0f, 1.0f, 1.0f);
+
+	for (int depth = 0; depth <= maxPathDepth; depth++) {
+		float t;
+		Surface *s = nullptr;
+		Vector3f normal;
+		ctx.segments++;
+
+		if (!scene.GetRoot().Hit(ray, RAY_T0, RAY_T1, &t, &s, &normal) || s == nullptr || !s->fHasMaterial())
+			break;
+
+		const MaterialRecord& material = s->GetMaterialRecord();
+		Point3f hitPoint = ray.origin + ray.direction * t;
+		normal.Normalize();
+		bool fOutSideIn = dot(normal, ray.direction) < 0;
+		Vector3f nf = fOutSideIn ? normal : normal * -1;
+
+		if (material.reflType == Type::DIFF) {
+			// Only specular bounces led here, so emission is not counted by
+			// any light sample.
+			RGBColor result;
+			if (material.fIsLight && fOutSideIn)
+				result = material.emissionColor;
+
+			result = result + scene.SampleDirect(hitPoint, nf, ctx.rng.NextFloat(), ctx.rng.NextFloat(), ctx.rng.NextFloat()) * material.materialColor;
+
+			if (photonMap.Size() > 0) {
+				RGBColor flux = photonMap.Gather(hitPoint, nf, radius);
+				result = result + flux * material.materialColor * static_cast<float>(1 / (M_PI * M_PI * radius * radius * emitted));
+			}
+			return beta * result;
+		}
+
+		Vector3f dir = ray.direction - nf * 2.0f * dot(ray.direction, nf);
+		if (material.reflType == Type::REFR) {
+			float ni = fOutSideIn ? material.extrRefrIndex : material.refrIndex;
+			float nt = fOutSideIn ? material.refrIndex : material.extrRefrIndex;
+			Vector3f refrDir;
+			if (ctx.rng.NextFloat() >= refractDielectric(ray.direction, nf, ni, nt, &refrDir))
+				dir = refrDir;
+		}
+		beta = beta * material.materialColor;
+		ray = Ray(hitPoint, dir);
+	}
+
+	return RGBColor();
+}
@@ -0,0 +1,52 @@
+// Photon mapping integrator.
+// Photons are emitted from the lights, followed through specular and
+// refractive surfaces and stored at the diffuse surfaces they bounce off.
+// Camera rays follow specular and refractive surfaces until they hit a
+// diffuse one, where direct lighting is sampled from the lights and indirect
+// lighting, caustics included, is estimated from the photons nearby.
+//
+// Used progressively, every pass emits a new set of photons and gathers
+// them with a smaller radius, so the average over the passes converges to
+// the right answer (Knaus and Zwicker, "Progressive Photon Mapping: A
+// Probabilistic Approach").
+#ifndef _PHOTONMAPPER_H
+#define _PHOTONMAPPER_H
+
+#include <vector>
+#include "Camera.h"
+#include "PhotonMap.h"
+#include "Scene.h"
+#include "ThreadContext.h"
+
+// Ratio of photons kept from one progressive pass to the next, which sets how
+// fast the gather radius shrinks.
+const float PHOTON_ALPHA = 2.0f / 3.0f;
+
+class PhotonMapper
+{
+public:
+	PhotonMapper(const Scene& _scene, const Camera& _camera);
+
+	// Replace the photon map with 'count' photons, emitted from all threads
+	// with random numbers started from 'seed'. The map only depends on
+	// 'count' and 'seed'.
+	void EmitPhotons(int count, unsigned long long seed);
+
+	// Return the radiance of the sample of pixel (w, h) started on the
+	// context's sampler, gathering the photons within 'radius'.
+	RGBColor Trace(ThreadContext& ctx, int w, int h, float radius) const;
+
+	// Return the gather radius of progressive pass 'pass', given the radius
+	// of the first pass.
+	static float GetPassRadius(float radius, int pass);
+
+private:
+	void TracePhoton(ThreadContext& ctx, std::vector<Photon> *photons) const;
+
+	const Scene& scene;
+	const Camera& camera;
+	PhotonMap photonMap;
+	int emitted;		// photons emitted for the current map, stored or not
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "ProgressReporter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "Utility.h"
+
+ProgressReporter::ProgressReporter(bool fQuiet, unsigned long long _totalSamples, double _deadline) : samplesDone(0),
+	totalSamples(_totalSamples), start(get_wall_time()), deadline(_deadline), fStop(false)
+{
+	if (!fQuiet)
+		reporter = std::thread(&ProgressReporter::Run, this);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+	Stop();
+}
+
+void ProgressReporter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		fStop = true;
+	}
+	wake.notify_all();
+	if (reporter.joinable())
+		reporter.join();
+}
+
+void ProgressReporter::Run()
+{
+	double lastTime = start;
+	unsigned long long lastSamples = 0;
+	double samplesPerSecond = 0.0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		if (wake.wait_for(lock, std::chrono::milliseconds(static_cast<int>(PROGRESS_INTERVAL * 1000)), [this] { return fStop; }))
+			return;
+
+		double now = get_wall_time();
+		unsigned long long samples = std::min(samplesDone.load(std::memory_order_relaxed), totalSamples);
+
+		// The speed over the last few intervals, as tiles finish in bursts, so
+		// that the time left follows passes of a different cost.
+		double intervalSpeed = (samples - lastSamples) / std::max(now - lastTime, 1e-6);
+		samplesPerSecond = lastTime == start ? intervalSpeed : 0.5 * (samplesPerSecond + intervalSpeed);
+		lastTime = now;
+		lastSamples = samples;
+
+		double done = totalSamples > 0 ? static_cast<double>(samples) / totalSamples : 0.0;
+		if (deadline > 0)
+			done = std::max(done, std::min((now - start) / std::max(deadline - start, 1e-6), 1.0));
+
+		if (samplesPerSecond <= 0) {
+			printf_s("Progress: %.0f%%, 0 samples/s\n", 100.0 * done);
+		}
+		else {
+			double eta = (totalSamples - samples) / samplesPerSecond;
+			if (deadline > 0)
+				eta = std::min(eta, std::max(deadline - now, 0.0));
+			printf_s("Progress: %.0f%%, %.0f samples/s, ETA %.1f s\n", 100.0 * done, samplesPerSecond, eta);
+		}
+		fflush(stdout);
+	}
+}
@@ -0,0 +1,46 @@
+// Reports how far rendering has got.
+// The rendering threads only add to an atomic counter of the samples taken
+// when they finish a tile, and a thread of its own prints the share of the
+// samples done, the speed and the time left every PROGRESS_INTERVAL seconds,
+// so that writing to the console never holds up the rendering threads.
+#ifndef _PROGRESSREPORTER_H
+#define _PROGRESSREPORTER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class ProgressReporter
+{
+public:
+	// Start reporting, unless 'fQuiet', on a render of 'totalSamples' pixel
+	// samples at most. With a 'deadline', a wall time, the share done is at
+	// least the share of the time gone, and the time left is never more than
+	// the time until it.
+	ProgressReporter(bool fQuiet, unsigned long long _totalSamples, double _deadline);
+	~ProgressReporter();
+
+	// Count a finished tile, in which 'samples' pixel samples were taken.
+	void AddTile(unsigned long long samples) {
+		samplesDone.fetch_add(samples, std::memory_order_relaxed);
+	}
+
+	// Stop reporting, before printing anything else.
+	void Stop();
+
+private:
+	void Run();
+
+	std::atomic<unsigned long long> samplesDone;
+	unsigned long long totalSamples;
+	double start;
+	double deadline;		// 0 for none
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool fStop;
+	std::thread reporter;
+};
+
+#endif
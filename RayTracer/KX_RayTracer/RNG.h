@@ -0,0 +1,58 @@
+// Random number generator.
+// PCG32 (O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically
+// Good Algorithms for Random Number Generation"): 64 bits of state, 32 bits
+// of output, and 2^63 independent streams picked by the increment. Each
+// thread owns one, so tracing never waits on a shared generator.
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+
+class RNG
+{
+public:
+	RNG() {
+		Seed(0, 0);
+	}
+
+	RNG(uint64_t seed, uint64_t stream) {
+		Seed(seed, stream);
+	}
+
+	// Start the sequence 'stream' at a position picked by 'seed'. Different
+	// streams never overlap, whatever their seeds.
+	void Seed(uint64_t seed, uint64_t stream) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		NextUInt();
+		state += mix(seed);
+		NextUInt();
+	}
+
+	uint32_t NextUInt() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+		uint32_t rot = static_cast<uint32_t>(old >> 59);
+		return (xorShifted >> rot) | (xorShifted << ((~rot + 1) & 31));
+	}
+
+	// Return a float in [0, 1), from the top 24 bits so that it never
+	// rounds up to 1.
+	float NextFloat() {
+		return (NextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+private:
+	// SplitMix64 finalizer, so that nearby seeds start far apart.
+	static uint64_t mix(uint64_t x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+#endif
@@ -1,25 +1,171 @@
 #include "Ray.h"
+#include "IrradianceCache.h"
+#include "PathGuide.h"
+#include "ReSTIR.h"
+#include "Sampler.h"
+#include "Scene.h"
 #include "Surface.h"
 #include <algorithm>
 #include <functional>
 
-static float hemisphereStepLength = static_cast<float>(M_PI) / HEMISPHERE_SAMPLES;
-static float eclipticStepLength = static_cast<float>(2 * M_PI) / ECLIPTIC_SAMPLES;
+namespace {
+
+// Sines and cosines of the first angles of 'count' equal strata of an angle
+// 'range', built at startup. A jittered angle in stratum i is the first angle
+// plus a small one, whose sine and cosine are combined with the table's.
+template<int count>
+struct StratumTable {
+	float step;
+	float sin[count];
+	float cos[count];
+
+	StratumTable(double range) {
+		step = static_cast<float>(range / count);
+		for (int i = 0; i < count; i++) {
+			sin[i] = static_cast<float>(std::sin(range * i / count));
+			cos[i] = static_cast<float>(std::cos(range * i / count));
+		}
+	}
+
+	// Sine and cosine of the angle in stratum 'i' whose jitter, past the
+	// first angle, has sine 'sinJitter' and cosine 'cosJitter'.
+	void Get(int i, float sinJitter, float cosJitter, float *s, float *c) const {
+		*s = sin[i] * cosJitter + cos[i] * sinJitter;
+		*c = cos[i] * cosJitter - sin[i] * sinJitter;
+	}
+};
+
+}
 
-// RGBColor returned must have 0<=r<=1, 0<=g<=1, 0<=b<=1.
-RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool fHitDiffuse) const {
+static const StratumTable<HEMISPHERE_SAMPLES> hemisphereStrata(M_PI);
+static const StratumTable<ECLIPTIC_SAMPLES> eclipticStrata(2 * M_PI);
+static const StratumTable<IRRADIANCE_PHI_SAMPLES> irradiancePhiStrata(2 * M_PI);
 
+// Compute the irradiance at the diffuse point 'p' facing 'n' from a
+// stratified hemisphere of rays, and add it to the irradiance cache all the
+// threads share as a new record together with its gradients (Ward and
+// Heckbert, "Irradiance Gradients").
+static RGBColor cacheIrradiance(const Scene& scene, ThreadContext& ctx, const Point3f& p, const Vector3f& n, int depth, const RGBColor& throughput)
+{
+	const int M = IRRADIANCE_THETA_SAMPLES;
+	const int N = IRRADIANCE_PHI_SAMPLES;
+
+	Vector3f u, v;
+	orthonormalBasis(n, &u, &v);
+
+	ScratchArena::Mark mark = ctx.arena.GetMark();
+	RGBColor *L = ctx.arena.Alloc<RGBColor>(M * N);
+	float *R = static_cast<float*>(ctx.arena.Alloc(M * N * sizeof(float)));
+	float *thetaJitter = static_cast<float*>(ctx.arena.Alloc(M * N * sizeof(float)));
+	float *phiJitter = static_cast<float*>(ctx.arena.Alloc(M * N * sizeof(float)));
+	float *sinPhiJitter = static_cast<float*>(ctx.arena.Alloc(M * N * sizeof(float)));
+	float *cosPhiJitter = static_cast<float*>(ctx.arena.Alloc(M * N * sizeof(float)));
+
+	for (int i = 0; i < M * N; i++) {
+		thetaJitter[i] = ctx.rng.NextFloat();
+		phiJitter[i] = irradiancePhiStrata.step * ctx.rng.NextFloat();
+	}
+	fastSinCos(phiJitter, sinPhiJitter, cosPhiJitter, M * N);
+
+	// Cosine-weighted strata: sin^2(theta) is uniform in [j / M, (j + 1) / M).
+	RGBColor sum;
+	float inverseDistanceSum = 0.0f;
+	for (int j = 0; j < M; j++) {
+		for (int k = 0; k < N; k++) {
+			float sin2Theta = (j + thetaJitter[j * N + k]) / M;
+			float sinTheta = sqrt(sin2Theta);
+			float cosTheta = sqrt(1 - sin2Theta);
+			float sinPhi, cosPhi;
+			irradiancePhiStrata.Get(k, sinPhiJitter[j * N + k], cosPhiJitter[j * N + k], &sinPhi, &cosPhi);
+			Ray ray(p, u * (sinTheta * cosPhi) + v * (sinTheta * sinPhi) + n * cosTheta);
+
+			L[j * N + k] = ray.traceForColor(scene, ctx, depth, throughput, true /*fHitDiffuse*/, &R[j * N + k]);
+
+			sum = sum + L[j * N + k];
+			inverseDistanceSum += 1.0f / R[j * N + k];
+		}
+	}
+
+	IrradianceSample sample;
+	sample.E = sum * static_cast<float>(M_PI / (M * N));
+
+	// Gradients, accumulated per color channel.
+	for (int c = 0; c < 3; c++) {
+		sample.rotGradient[c] = Vector3f();
+		sample.transGradient[c] = Vector3f();
+	}
+
+	// The middle of every stratum in phi is half a step past its first angle.
+	float sinHalfStep, cosHalfStep;
+	fastSinCos(irradiancePhiStrata.step * 0.5f, &sinHalfStep, &cosHalfStep);
+
+	for (int k = 0; k < N; k++) {
+		float sinPhi, cosPhi;
+		irradiancePhiStrata.Get(k, sinHalfStep, cosHalfStep, &sinPhi, &cosPhi);
+		Vector3f uk = u * cosPhi + v * sinPhi;
+		Vector3f vk = u * -sinPhi + v * cosPhi;
+		Vector3f vkMinus = u * -irradiancePhiStrata.sin[k] + v * irradiancePhiStrata.cos[k];
+		int kPrev = (k + N - 1) % N;
+
+		for (int j = 0; j < M; j++) {
+			float sinTheta = sqrt((j + 0.5f) / M);
+			float tanTheta = sinTheta / sqrt(1 - sinTheta * sinTheta);
+			float sin2ThetaMinus = static_cast<float>(j) / M;
+			float cosThetaMinus = sqrt(1 - sin2ThetaMinus);
+			float cosThetaPlus = sqrt(1 - static_cast<float>(j + 1) / M);
+			const RGBColor& Ljk = L[j * N + k];
+
+			RGBColor rot = Ljk * (-tanTheta * static_cast<float>(M_PI / (M * N)));
+
+			// Change across the boundary with the previous stratum in phi.
+			RGBColor dPhi = (Ljk - L[j * N + kPrev]) * ((cosThetaMinus - cosThetaPlus) / (sinTheta * std::min(R[j * N + k], R[j * N + kPrev])));
+
+			// Change across the boundary with the previous stratum in theta.
+			RGBColor dTheta;
+			if (j > 0) {
+				float w = sqrt(sin2ThetaMinus) * cosThetaMinus * cosThetaMinus / std::min(R[j * N + k], R[(j - 1) * N + k]);
+				dTheta = (Ljk - L[(j - 1) * N + k]) * (w * static_cast<float>(2 * M_PI) / N);
+			}
+
+			sample.rotGradient[0] = sample.rotGradient[0] + vk * rot.r;
+			sample.rotGradient[1] = sample.rotGradient[1] + vk * rot.g;
+			sample.rotGradient[2] = sample.rotGradient[2] + vk * rot.b;
+			sample.transGradient[0] = sample.transGradient[0] + uk * dTheta.r + vkMinus * dPhi.r;
+			sample.transGradient[1] = sample.transGradient[1] + uk * dTheta.g + vkMinus * dPhi.g;
+			sample.transGradient[2] = sample.transGradient[2] + uk * dTheta.b + vkMinus * dPhi.b;
+		}
+	}
+
+	ctx.arena.Rewind(mark);
+	ctx.irradianceCache->Add(p, n, sample, M * N / inverseDistanceSum);
+	return sample.E;
+}
+
+// RGBColor returned is not clamped, the caller clamps the pixel's final color.
+RGBColor Ray::traceForColor(const Scene& scene, ThreadContext& ctx, int depth, const RGBColor& throughput, bool fHitDiffuse,
+	float *hitDistance) const {
+
+	const Surface& surface = scene.GetRoot();
 	float t;
 	Surface *s = nullptr;
 	Vector3f normal;
 	depth++;
-
-	if (surface.Hit(*this, RAY_T0, RAY_T1, &t, &s, &normal) == false) {
-		// Did not hit anything, return background color: black.
-		return RGBColor(0.0f, 0.0f, 0.0f);
+	ctx.segments++;
+
+	bool fHit = surface.Hit(*this, RAY_T0, RAY_T1, &t, &s, &normal);
+	if (hitDistance)
+		*hitDistance = fHit ? t : RAY_T1;
+
+	if (fHit == false) {
+		// Did not hit anything, return the environment, black without one.
+		// Like the lights, the environment is sampled directly for diffuse
+		// surfaces with the irradiance cache.
+		if (ctx.irradianceCache && fHitDiffuse)
+			return RGBColor(0.0f, 0.0f, 0.0f);
+		return scene.GetBackground(direction);
 	}
 
-	if (s == nullptr || s->GetMaterial() == nullptr) {
+	if (s == nullptr || !s->fHasMaterial()) {
 		// If reached here, somehow the material of this surface does not exist.
 		// This should not happen.
 		return RGBColor(0.0f, 0.0f, 0.0f);
@@ -32,53 +178,75 @@ RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool
 	bool fRayNormalOnSameSide = dot(normal, direction) < 0;
 	normal = fRayNormalOnSameSide ? normal : normal * -1;
 
-	std::shared_ptr<Material> pMaterial = s->GetMaterial();
+	const MaterialRecord& material = s->GetMaterialRecord();
 
-	RGBColor materialColor = pMaterial->materialColor;
-	RGBColor emissionColor = pMaterial->emissionColor;
+	RGBColor materialColor = material.materialColor;
+	RGBColor emissionColor = material.emissionColor;
 
-	if ((depth > 2 && _rand() > prob) || depth > 5) {
+	if (depth > maxPathDepth) {
 		return emissionColor;
 	}
 
-	if (pMaterial->reflType == Type::DIFF)
+	// Russian roulette: past the minimum depth, continue the path with a
+	// probability that follows its throughput, so dark paths are dropped
+	// early, and scale up the surviving paths to keep the estimate unbiased.
+	float survival = 1.0f;
+	if (depth > minPathDepth) {
+		survival = std::min(std::max(throughput.r, std::max(throughput.g, throughput.b)), 0.95f);
+		if (ctx.sampler->Get1D() >= survival)
+			return emissionColor;
+	}
+	RGBColor pathThroughput = throughput * (1.0f / survival);
+
+	if (material.reflType == Type::DIFF)
 	{
 		// Treat front face of a light as light, treat its back face as
 		// a regular non-light surface.
-		if (s->fIsLight() && fRayNormalOnSameSide)
-			return emissionColor;
-		else if (s->fIsLight())
+		// With the irradiance cache, the light reaching a diffuse surface
+		// straight from a light is sampled directly instead.
+		if (material.fIsLight && fRayNormalOnSameSide)
+			return (ctx.irradianceCache && fHitDiffuse) ? RGBColor() : emissionColor;
+		else if (material.fIsLight)
 			return RGBColor();
 
 		RGBColor result;
 
-		if (fUseFastShading) {
-			std::vector<const Surface*> lights;
-			surface.GatherLightSources(lights);
-			std::vector<const Surface*>::const_iterator it;
-			for (it = lights.begin(); it != lights.end(); ++it)
-			{
-				const Surface *light = *it;
-				RGBColor lightResult;
+		if (ctx.irradianceCache) {
+			// Direct light from stratified points on the lights, the rest from
+			// the irradiance cache.
+			RGBColor direct;
+			for (int i = 0; i < LIGHT_SAMPLES; i++) {
+				float u1, u2;
+				lightGridSample(i, ctx.rng, &u1, &u2);
+				direct = direct + scene.SampleDirect(hitPoint, normal, ctx.rng.NextFloat(), u1, u2) + scene.SampleEnvironment(hitPoint, normal, u1, u2);
+			}
 
-				for (int gridIndex = 0; gridIndex < LIGHT_SAMPLES; gridIndex++)
-				{
-					Vector3f L(hitPoint /*Start*/, light->GetLightPointInGrid(gridIndex) /*End*/);
-					L.Normalize();
-					Ray rayTowardsLight(hitPoint, L);
-					float dotP = dot(L, normal);
-					RGBColor DiffC = (dotP > 0) ? rayTowardsLight.traceForLight(surface, light) * dotP * s->GetMaterial()->diffAmount * materialColor
-						: RGBColor();
-
-					lightResult = lightResult + DiffC;
-				}
+			RGBColor irradiance;
+			if (!ctx.irradianceCache->Lookup(hitPoint, normal, &irradiance))
+				irradiance = cacheIrradiance(scene, ctx, hitPoint, normal, depth, pathThroughput * materialColor);
 
-				lightResult = (lightResult * (1.0f / LIGHT_SAMPLES)).Trunc();
-				result = result + lightResult;
+			return materialColor * (direct * (1.0f / LIGHT_SAMPLES) + irradiance * static_cast<float>(1 / M_PI)) * (1.0f / survival);
+		}
+
+		if (shadingMode == ShadingMode::FAST) {
+			// For each cell of the light grid, draw many light candidates in it
+			// without tracing them, keep one by resampling them by their
+			// unshadowed contribution, and trace a shadow ray for it. Points
+			// in one cell of one light differ too little for resampling to
+			// pay for its candidates, so a single light takes one.
+			int candidates = std::max(1, std::min(RIS_CANDIDATES, scene.GetLights().Size()));
+			RGBColor direct;
+			for (int i = 0; i < LIGHT_SAMPLES; i++) {
+				Reservoir r = SampleLightCandidates(scene, hitPoint, normal, candidates, i /*stratum*/, ctx.rng);
+				direct = direct + ShadeReservoir(scene, hitPoint, normal, r);
 			}
+
+			float u1, u2;
+			ctx.sampler->Get2D(&u1, &u2);
+			direct = direct * (1.0f / LIGHT_SAMPLES) + scene.SampleEnvironment(hitPoint, normal, u1, u2);
+			result = direct * material.diffAmount * materialColor * (1.0f / survival);
 		}
 		else {
-			// Create multiple diffuse rays bouncing off from the hit point.
 			// Create orthonormal coordinate frame at the hit point (w, u, v).
 			Vector3f w = normal;
 			Vector3f u = cross((fabs(w.x) > 0.1) ? Vector3f(0, 1.f, 0) : Vector3f(1.f, 0, 0), w); // u is perpendicular to w
@@ -86,48 +254,127 @@ RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool
 			u.Normalize();
 			v.Normalize();
 
-			std::vector<RGBColor> diffuseResults;
+			if (shadingMode == ShadingMode::COSINE) {
+				// Importance sample a single diffuse reflection ray with a cosine-weighted
+				// pdf. The cosine term and the pdf cancel out, leaving the material color.
+				float u1, u2;
+				ctx.sampler->Get2D(&u1, &u2);
+				float sinPhi, cosPhi;
+				fastSinCos(static_cast<float>(2 * M_PI) * u1, &sinPhi, &cosPhi);
+				float r2 = u2;
+				float r2s = sqrt(r2);
+
+				Vector3f diffRelfDir = u * cosPhi * r2s + v * sinPhi * r2s + w * sqrt(1 - r2);
+
+				const EnvironmentMap *environment = scene.GetEnvironment();
+				if (ctx.pathGuide || environment) {
+					// Mix the learned distribution and the environment with cosine
+					// sampling, so that directions neither of them knows light
+					// from are still explored.
+					PathGuide *guide = ctx.pathGuide;
+					bool fGuided = guide && guide->fCanSample(hitPoint, w);
+					float uStrategy = ctx.sampler->Get1D();
+					if (environment && uStrategy < ENVIRONMENT_FRACTION) {
+						float environmentPdf;
+						ctx.sampler->Get2D(&u1, &u2);
+						diffRelfDir = environment->Sample(u1, u2, &environmentPdf);
+					}
+					else if (fGuided && ctx.sampler->Get1D() < GUIDING_FRACTION) {
+						float guidePdf;
+						ctx.sampler->Get2D(&u1, &u2);
+						diffRelfDir = guide->Sample(hitPoint, w, u1, u2, &guidePdf);
+					}
+
+					float cosTheta = dot(diffRelfDir, w);
+					if (cosTheta <= 0)
+						return RGBColor();
+
+					float pdf = cosTheta / static_cast<float>(M_PI);
+					if (fGuided)
+						pdf = GUIDING_FRACTION * guide->Pdf(hitPoint, w, diffRelfDir) + (1 - GUIDING_FRACTION) * pdf;
+					if (environment)
+						pdf = ENVIRONMENT_FRACTION * environment->Pdf(diffRelfDir) + (1 - ENVIRONMENT_FRACTION) * pdf;
+
+					float weight = cosTheta / static_cast<float>(M_PI * pdf);
+					Ray diffRelfRay(hitPoint, diffRelfDir);
+					RGBColor tracedColor = diffRelfRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor * weight, true /*fHitDiffuse*/);
+
+					if (guide)
+						guide->Record(hitPoint, w, diffRelfDir, luminance(tracedColor), pdf);
+					return materialColor * tracedColor * (weight / survival);
+				}
+
+				Ray diffRelfRay(hitPoint, diffRelfDir);
+				RGBColor tracedColor = diffRelfRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor, true /*fHitDiffuse*/);
+
+				return materialColor * tracedColor * (1.0f / survival);
+			}
+
+			// Create multiple diffuse rays bouncing off from the hit point. The
+			// results live in the thread's scratch arena, released on return.
+			const int fanSize = HEMISPHERE_SAMPLES * ECLIPTIC_SAMPLES;
+			ScratchArena::Mark mark = ctx.arena.GetMark();
+			RGBColor *diffuseResults = ctx.arena.Alloc<RGBColor>(fanSize);
+			int diffuseCount = 0;
+
+			// Jitters of theta and phi in their strata, interleaved, and their
+			// sines and cosines all at once.
+			float *jitter = static_cast<float*>(ctx.arena.Alloc(2 * fanSize * sizeof(float)));
+			float *sinJitter = static_cast<float*>(ctx.arena.Alloc(2 * fanSize * sizeof(float)));
+			float *cosJitter = static_cast<float*>(ctx.arena.Alloc(2 * fanSize * sizeof(float)));
+			for (int i = 0; i < fanSize; i++) {
+				jitter[2 * i] = hemisphereStrata.step * ctx.rng.NextFloat();
+				jitter[2 * i + 1] = eclipticStrata.step * ctx.rng.NextFloat();
+			}
+			fastSinCos(jitter, sinJitter, cosJitter, 2 * fanSize);
 
 			for (uint8_t longitude_coord = 0; longitude_coord < HEMISPHERE_SAMPLES; longitude_coord++)
 			{
 				for (uint8_t latitude_coord = 0; latitude_coord < ECLIPTIC_SAMPLES; latitude_coord++)
 				{
-					float theta = hemisphereStepLength * (longitude_coord + _rand());
-					float phi = eclipticStepLength * (latitude_coord + _rand());
-
-					float sin_theta = sin(theta);
-
-					Vector3f diffRelfDir = u * sin_theta * cos(phi) + v * sin_theta * sin(phi) + w * cos(theta);
+					int i = 2 * (longitude_coord * ECLIPTIC_SAMPLES + latitude_coord);
+					float sin_theta, cos_theta, sin_phi, cos_phi;
+					hemisphereStrata.Get(longitude_coord, sinJitter[i], cosJitter[i], &sin_theta, &cos_theta);
+					eclipticStrata.Get(latitude_coord, sinJitter[i + 1], cosJitter[i + 1], &sin_phi, &cos_phi);
+
+					Vector3f diffRelfDir = u * sin_theta * cos_phi + v * sin_theta * sin_phi + w * cos_theta;
+					// The candidates are clamped before they are ranked, as every
+					// traced color used to be, so that one ray to a light does not
+					// outweigh the rest of the fan.
 					Ray diffRelfRay(hitPoint, diffRelfDir);
-					RGBColor tracedColor = diffRelfRay.traceForColor(surface, depth, fHitDiffuse ? prob * DIFFUSE_FACTOR : prob, true /*fHitDiffuse*/);
+					RGBColor tracedColor = diffRelfRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor, true /*fHitDiffuse*/).Trunc();
 					
 					if (fHitDiffuse) {
 						// Perf optimization.
-						if (tracedColor.r >= 0.1f || tracedColor.g >= 0.1f || tracedColor.b >= 0.1f)
-							return tracedColor * materialColor;
+						if (tracedColor.r >= 0.1f || tracedColor.g >= 0.1f || tracedColor.b >= 0.1f) {
+							ctx.arena.Rewind(mark);
+							return tracedColor * materialColor * (1.0f / survival);
+						}
 					}
 					
-					diffuseResults.push_back(tracedColor);
+					diffuseResults[diffuseCount++] = tracedColor;
 				}
 			}
 
-			std::sort(diffuseResults.begin(), diffuseResults.end(), std::greater<RGBColor>());
+			// Only the four brightest results are used.
+			std::partial_sort(diffuseResults, diffuseResults + 4, diffuseResults + diffuseCount, std::greater<RGBColor>());
 
-			result = materialColor * (diffuseResults[0] + diffuseResults[1] + diffuseResults[2] + diffuseResults[3]) * 0.25;
+			result = materialColor * (diffuseResults[0] + diffuseResults[1] + diffuseResults[2] + diffuseResults[3]) * (0.25f / survival);
+			ctx.arena.Rewind(mark);
 		}
 
-		return result.Trunc();
+		return result;
 	}
-	else if (pMaterial->reflType == Type::SPEC)
+	else if (material.reflType == Type::SPEC)
 	{
 		// Create reflection ray.
 		Vector3f reflDir = direction - normal * 2.0f * dot(direction, normal);
 		Ray reflRay = Ray(hitPoint, reflDir);
 
-		RGBColor result = emissionColor + materialColor * reflRay.traceForColor(surface, depth, prob * REFLECTION_FACTOR, fHitDiffuse);
-		return result.Trunc();
+		RGBColor result = emissionColor + materialColor * reflRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor, fHitDiffuse) * (1.0f / survival);
+		return result;
 	}
-	else // pMaterial->reflType == Type::REFR
+	else // material.reflType == Type::REFR
 	{
 		Vector3f reflDir = direction - normal * 2.0f * dot(direction, normal);
 		Ray reflRay(hitPoint, reflDir);
@@ -135,8 +382,8 @@ RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool
 		bool fOutSideIn = fRayNormalOnSameSide;
 
 		// Ideal Dielectric Refraction
-		float ni = (fOutSideIn) ? pMaterial->extrRefrIndex : pMaterial->refrIndex;
-		float nt = (fOutSideIn) ? pMaterial->refrIndex : pMaterial->extrRefrIndex;
+		float ni = (fOutSideIn) ? material.extrRefrIndex : material.refrIndex;
+		float nt = (fOutSideIn) ? material.refrIndex : material.extrRefrIndex;
 
 		float nnt = ni / nt;                             // sin(t) / sin(i)
 		float cosi = fabs(dot(direction, normal));       // cos(i)
@@ -144,8 +391,8 @@ RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool
 
 		if (cos2t < 0) // Total internal Reflection
 		{
-			RGBColor result = emissionColor + materialColor * reflRay.traceForColor(surface, depth, prob * REFLECTION_FACTOR, fHitDiffuse);
-			return result.Trunc();
+			RGBColor result = emissionColor + materialColor * reflRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor, fHitDiffuse) * (1.0f / survival);
+			return result;
 		}
 
 		float cost = sqrt(cos2t);
@@ -162,11 +409,23 @@ RGBColor Ray::traceForColor(const Surface& surface, int depth, float prob, bool
 		float Rp = pow((nnt * cost - cosi) / (nnt * cost + cosi), 2);
 		float refl_Intensity = (Rs + Rp) / 2;
 
+		if (fStochasticFresnel) {
+			// Follow only one of the two rays, picked with a probability equal to
+			// its Fresnel weight so that the weight and the probability cancel.
+			// This keeps the path from branching at every dielectric.
+			RGBColor result;
+			if (ctx.sampler->Get1D() < refl_Intensity)
+				result = emissionColor + materialColor * reflRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor, fHitDiffuse) * (1.0f / survival);
+			else
+				result = emissionColor + materialColor * refrRay.traceForColor(scene, ctx, depth - 1, pathThroughput * materialColor, fHitDiffuse) * (1.0f / survival);
+			return result;
+		}
+
 		RGBColor result = emissionColor + materialColor * (
-			reflRay.traceForColor(surface, depth, prob * REFLECTION_FACTOR, fHitDiffuse) * refl_Intensity +
-			refrRay.traceForColor(surface, depth - 1, prob * REFRACTION_FACTOR, fHitDiffuse) * (1 - refl_Intensity));
+			reflRay.traceForColor(scene, ctx, depth, pathThroughput * materialColor * refl_Intensity, fHitDiffuse) * refl_Intensity +
+			refrRay.traceForColor(scene, ctx, depth - 1, pathThroughput * materialColor * (1 - refl_Intensity), fHitDiffuse) * (1 - refl_Intensity)) * (1.0f / survival);
 
-		return result.Trunc();
+		return result;
 	}
 };
 
@@ -184,7 +443,7 @@ RGBColor Ray::traceForLight(const Surface& surface, const Surface *light) const
 		return RGBColor(0.0f, 0.0f, 0.0f);
 	}
 
-	if (s == nullptr || s->GetMaterial() == nullptr) {
+	if (s == nullptr || !s->fHasMaterial()) {
 		// If reached here, somehow the material of this surface does not exist.
 		// This should not happen.
 		std::cerr << "Error: Didn't find light correctly as expect." << std::endl;
@@ -194,5 +453,5 @@ RGBColor Ray::traceForLight(const Surface& surface, const Surface *light) const
 	if (s != light) // something blocked
 		return RGBColor();
 	else
-		return s->GetMaterial()->emissionColor;
+		return s->GetMaterialRecord().emissionColor;
 }
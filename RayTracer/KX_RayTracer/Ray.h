@@ -1,8 +1,11 @@
 #ifndef _RAY_H
 #define _RAY_H
 
+#include "ThreadContext.h"
 #include "Utility.h"
 
+class Scene;
+
 struct Ray {
 	Point3f origin;
 	Vector3f direction;
@@ -13,9 +16,13 @@ struct Ray {
 		direction.Normalize();
 	}
 
-	// 'prob' is the likelyhood to keep reflecting once 'depth' is certain value.
+	// 'throughput' is how much the color returned contributes to the pixel,
+	// it drives the Russian roulette once 'depth' is past minPathDepth.
 	// 'fHitDiffuse' indicates whether or not a diffuse surface has been hit.
-	RGBColor traceForColor(const Surface& surface, int depth, float prob, bool fHitDiffuse) const;
+	// The distance to the first hit is stored in 'hitDistance', RAY_T1 if
+	// nothing is hit.
+	RGBColor traceForColor(const Scene& scene, ThreadContext& ctx, int depth, const RGBColor& throughput, bool fHitDiffuse,
+		float *hitDistance = nullptr) const;
 
 	RGBColor traceForLight(const Surface& surface, const Surface *light) const;
 };
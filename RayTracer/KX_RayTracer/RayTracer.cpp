@@ -1,32 +1,259 @@
 #include <cstdlib>
 #include <ctime>
+#include <fstream>
+#include <limits>
+#include <vector>
 #include <omp.h>
 #include <Windows.h>
+#include "AllocationCounter.h"
+#include "BDPT.h"
+#include "BlueNoise.h"
+#include "Camera.h"
+#include "EnvironmentMap.h"
 #include "Group.h"
+#include "IrradianceCache.h"
+#include "PathGuide.h"
+#include "PhotonMapper.h"
+#include "ProgressReporter.h"
 #include "Ray.h"
+#include "ReSTIR.h"
+#include "Sampler.h"
+#include "Scene.h"
 #include "SimpleImage.h"
 #include "Sphere.h"
+#include "SplatBuffer.h"
+#include "TileScheduler.h"
 #include "Utility.h"
+#include "VarianceBuffer.h"
 #include "Wall.h"
 
 using namespace std;
 
-float getSceneX(int w, int imgWidth, float planeMinX, float planeMaxX) {
-	return planeMinX + (float)w / imgWidth * (planeMaxX - planeMinX);
-}
-
-float getSceneY(int h, int imgHeight, float planeMinY, float planeMaxY) {
-	return planeMaxY - (float)h / imgHeight * (planeMaxY - planeMinY);
-}
+enum class Integrator : char {
+	PATH,		// path tracing with Ray::traceForColor
+	BDPT,		// bidirectional path tracing
+	PHOTON,		// photon mapping
+};
+
+// Options of a render that are not global shading settings.
+struct RenderOptions {
+	std::string reference_name;		// image to compute the RMSE against, none if empty
+	std::string environment_name;	// environment map to light the scene with, none if empty
+	std::string convergence_name;	// CSV file of the RMSE against the reference over time, none if empty
+	SamplerType sampler;
+	Integrator integrator;
+	int photons;					// photons emitted per pass
+	float photonRadius;				// gather radius of the first pass
+	int photonPasses;				// more than one shrinks the radius from pass to pass
+	float targetError;				// adaptive sampling stops at this RMSE, 0 to take effort samples everywhere
+	double timeBudget;				// seconds to render for, 0 to render until effort is reached
+	double snapshotSeconds;			// write the image so far after a pass once this much time has passed, 0 never
+	int snapshotPasses;				// write the image so far after this many passes, 0 never
+	bool fIrradianceCache;			// interpolate indirect diffuse light in slow diffuse mode
+	bool fPathGuiding;				// learn where light comes from in cosine diffuse mode
+	bool fReSTIR;					// reuse light samples between pixels in fast diffuse mode
+	bool fReSTIRTemporal;			// also reuse them from one sample to the next
+	unsigned long long seed;		// starts the random numbers of every pixel sample
+	bool fFixedSeed;				// 'seed' was given, otherwise it is picked from the time
+	bool fQuiet;					// print the results only, not the progress
+	bool fCheckAllocations;			// check that tracing makes no heap allocations after the first pass
+
+	RenderOptions() {
+		integrator = Integrator::PATH;
+		sampler = SamplerType::SOBOL;
+		photons = 200000;
+		photonRadius = 0.5f;
+		photonPasses = 1;
+		targetError = 0.0f;
+		timeBudget = 0.0;
+		snapshotSeconds = 0.0;
+		snapshotPasses = 0;
+		fIrradianceCache = false;
+		fPathGuiding = false;
+		fReSTIR = false;
+		fReSTIRTemporal = false;
+		seed = 0;
+		fFixedSeed = false;
+		fQuiet = false;
+		fCheckAllocations = false;
+	}
+};
 
 void usage_message() {
-	std::cout << "Usage: ./KX_RayTracer <output_file> <x_res> <y_res> <tracing scene> <effort> <fast_diffuse> <threads>" << std::endl;
+	std::cout << "Usage: ./KX_RayTracer <output_file> <x_res> <y_res> <tracing scene> <effort> <fast_diffuse> <threads> [options]" << std::endl;
 	std::cout << "{x_res, y_res} resolutions should be given in pixels." << std::endl;
 	std::cout << "effort is how many rays to shoot for each pixel." << std::endl;
 	std::cout << "fast_diffuse: 1 for fast Lambertian shading. 0 for slow diffuse reflections." << std::endl;
+	std::cout << "              2 for one cosine-weighted diffuse reflection per hit, use a higher effort with it." << std::endl;
 	std::cout << "threads: how many threads to use for OpenMP." << std::endl;
 	std::cout << "tracing scences: " << std::endl;
 	std::cout << "	1 - basic" << std::endl;
+	std::cout << "	2 - mesh" << std::endl;
+	std::cout << "	3 - glass and diamonds" << std::endl;
+	std::cout << "	4 - light through a gap in the ceiling" << std::endl;
+	std::cout << "	5 - many small lights" << std::endl;
+	std::cout << "	6 - outdoors, under a sky with a sun unless --environment is given" << std::endl;
+	std::cout << "options: " << std::endl;
+	std::cout << "	--reference <file> - report the RMSE of the result against a reference image." << std::endl;
+	std::cout << "	--environment <file> - light the scene with a latitude-longitude HDR image, +y up." << std::endl;
+	std::cout << "	              bdpt and photon ignore it." << std::endl;
+	std::cout << "	--sampler <independent|halton|sobol|bluenoise> - numbers the camera paths are made of. bluenoise spreads" << std::endl;
+	std::cout << "	          the error of a few samples as blue noise, for previews. bluenoise by default up to effort 8," << std::endl;
+	std::cout << "	          sobol above." << std::endl;
+	std::cout << "	--convergence <file> - with --reference, write the RMSE after 1, 2, 4... samples per pixel to a CSV file." << std::endl;
+	std::cout << "	--target-error <e> - adaptive sampling: give the noisier pixels more samples, until the expected RMSE of" << std::endl;
+	std::cout << "	                     the image is below e, with effort as the most samples a pixel may take. Path" << std::endl;
+	std::cout << "	                     tracing only, without --guiding or --restir." << std::endl;
+	std::cout << "	--time-budget <s> - render passes over all pixels until s seconds have passed, sizing the last ones to" << std::endl;
+	std::cout << "	                    finish in time, with effort as the most samples a pixel may take. Tiles being" << std::endl;
+	std::cout << "	                    rendered at the deadline finish. Path tracing only, without --guiding or --restir." << std::endl;
+	std::cout << "	--snapshot-seconds <s> - render in passes of 1, 2, 4... samples per pixel, and write the image so far to" << std::endl;
+	std::cout << "	                         the output file every s seconds. Passes are cut short to end at the next write," << std::endl;
+	std::cout << "	                         except with photon mapping, --guiding or --restir." << std::endl;
+	std::cout << "	--snapshot-passes <n> - the same, every n passes." << std::endl;
+	std::cout << "	--seed <n> - start the random numbers from 'n' instead of the time. The output then only depends on" << std::endl;
+	std::cout << "	             the options, not on the threads or the machine, except with --irradiance-cache." << std::endl;
+	std::cout << "	--quiet - only print the results, not the progress." << std::endl;
+	std::cout << "	--check-allocations - render with the other options in passes, and fail if tracing allocates heap memory" << std::endl;
+	std::cout << "	                      after the first pass. Blocks of irradiance cache records are counted apart." << std::endl;
+	std::cout << "	--min-depth <n> - bounces before Russian roulette may end a path, 2 by default." << std::endl;
+	std::cout << "	--max-depth <n> - bounces after which a path always ends, 5 by default." << std::endl;
+	std::cout << "	--stochastic-fresnel - follow one of reflection or refraction at glass, picked by the Fresnel weight." << std::endl;
+	std::cout << "	--irradiance-cache - with slow diffuse shading, reuse indirect diffuse light from a cache of irradiance records." << std::endl;
+	std::cout << "	--guiding - with cosine diffuse shading, learn where light comes from over passes of 1, 2, 4... samples and sample it." << std::endl;
+	std::cout << "	            Each pass counts in the image in inverse proportion to its variance." << std::endl;
+	std::cout << "	            It does not pay off yet: on scene 4 it is about 5% less noisy at 128x128 and 1024 samples, and" << std::endl;
+	std::cout << "	            noisier than without it at 64x64 and 256 samples, where too few samples reach each cell to learn." << std::endl;
+	std::cout << "	--restir - with fast diffuse shading, reuse the light samples of nearby pixels." << std::endl;
+	std::cout << "	--restir-temporal - like --restir, and also reuse them from one sample to the next. Makes every sample" << std::endl;
+	std::cout << "	                    better on its own, for sequences, but the average converges more slowly." << std::endl;
+	std::cout << "	--integrator <path|bdpt|photon> - path tracing (default), bidirectional path tracing or photon mapping." << std::endl;
+	std::cout << "	              fast_diffuse is ignored by bdpt and photon." << std::endl;
+	std::cout << "	--photons <n> - photons emitted per pass by photon mapping, 200000 by default." << std::endl;
+	std::cout << "	--photon-radius <r> - photon gather radius, 0.5 by default." << std::endl;
+	std::cout << "	--photon-passes <n> - progressive photon mapping passes, effort is split between them. 1 by default." << std::endl;
+}
+
+// Root mean square error between two images of the same size, over all channels.
+float computeRMSE(const SimpleImage& img, const SimpleImage& ref) {
+	double sum = 0.0;
+	for (int h = 0; h < img.height(); h++) {
+		for (int w = 0; w < img.width(); w++) {
+			RGBColor a = img(w, h);
+			RGBColor b = ref(w, h);
+			sum += (a.r - b.r) * (a.r - b.r) + (a.g - b.g) * (a.g - b.g) + (a.b - b.b) * (a.b - b.b);
+		}
+	}
+	return static_cast<float>(sqrt(sum / (3.0 * img.width() * img.height())));
+}
+
+// Average the sums of 'samples' samples per pixel in 'image' and 'splats',
+// if any, into the image to save. With 'stats', every pixel is averaged over its
+// own number of samples instead.
+SimpleImage resolveImage(const RGBColor *image, const SplatBuffer *splats, int img_w, int img_h, int samples,
+	const VarianceBuffer *stats = nullptr) {
+	SimpleImage result(img_w, img_h, RGBColor(0, 0, 0));
+	for (int h = 0; h < img_h; h++) {
+		for (int w = 0; w < img_w; w++) {
+			int pixelSamples = stats ? std::max(stats->GetCount(w, h), 1) : samples;
+			RGBColor color = *(image + h * img_w + w);
+			if (splats)
+				color = color + splats->Get(w, h);
+			color = color * (1.0f / pixelSamples);
+			result.set(w, h, color.Trunc());
+		}
+	}
+	return result;
+}
+
+// Save 'image' as 'name' without ever leaving a partly written file there:
+// write it next to it first, then move it over the old one.
+bool saveReplacing(SimpleImage& image, const std::string& name) {
+	std::string tempName = name + ".tmp";
+	if (!image.save(tempName))
+		return false;
+	if (!MoveFileExA(tempName.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		cerr << "Error: could not replace '" << name << "'." << endl;
+		return false;
+	}
+	return true;
+}
+
+// Random number stream of sample 'sampleIndex' of pixel (w, h), so that the
+// sample draws the same numbers whichever thread traces it. 'phase' tells
+// apart the streams of the steps of a sample traced at different times.
+unsigned long long pixelStream(int w, int h, int img_w, int img_h, int sampleIndex, int phase) {
+	return ((static_cast<unsigned long long>(sampleIndex) * img_h + h) * img_w + w) * 2 + phase;
+}
+
+// Mark in 'active' the pixels that need more samples for the image to reach
+// the RMSE 'target', and return how many there are. The squared error of the
+// image is the average of deviation^2 / samples over the pixels, which is
+// smallest for a number of samples that grows with the deviation of each
+// pixel (not with its variance, which would give every pixel the same error
+// for no gain in the total). A pixel counts as noisy as the noisiest of its
+// neighbours, in case its first samples all missed a rare bright path that
+// they found. Pixels are not given more than 'effort' samples.
+int markActivePixels(const VarianceBuffer& stats, float target, int effort, int img_w, int img_h, std::vector<char> *active) {
+	std::vector<float> deviations(img_w * img_h);
+	double total = 0.0;
+	for (int h = 0; h < img_h; h++) {
+		for (int w = 0; w < img_w; w++) {
+			float deviation = 0.0f;
+			for (int y = std::max(h - 1, 0); y <= std::min(h + 1, img_h - 1); y++) {
+				for (int x = std::max(w - 1, 0); x <= std::min(w + 1, img_w - 1); x++)
+					deviation = std::max(deviation, stats.GetDeviation(x, y));
+			}
+			deviations[h * img_w + w] = deviation;
+			total += deviation;
+		}
+	}
+
+	// samples = deviation * total / (pixels * target^2) gives the target.
+	double scale = total / (static_cast<double>(img_w) * img_h * target * target);
+	int count = 0;
+	for (int i = 0; i < img_w * img_h; i++) {
+		int samples = stats.GetCount(i % img_w, i / img_w);
+		bool fActive = samples < effort && samples < deviations[i] * scale;
+		(*active)[i] = fActive;
+		count += fActive;
+	}
+	return count;
+}
+
+// Add a pass of 'passSamples' samples per pixel, summed in 'pass', to
+// 'image', weighting every pass by the inverse of its variance (Müller,
+// "Practical Path Guiding in Production"), so that the passes taken while
+// the guide was still learning count for less. 'image' holds the weighted
+// average of the passes so far times their 'samples', so that it resolves
+// like a plain sum, and 'weights' is their total weight. Return the new
+// total weight.
+double addWeightedPass(RGBColor *image, const RGBColor *pass, const VarianceBuffer& passStats, int img_w, int img_h,
+	int samples, int passSamples, double weights) {
+	// The expected squared error of the pass, as the RMSE would see it.
+	double variance = 0.0;
+	for (int h = 0; h < img_h; h++) {
+		for (int w = 0; w < img_w; w++) {
+			double deviation = passStats.GetDeviation(w, h);
+			variance += deviation * deviation;
+		}
+	}
+	variance /= static_cast<double>(img_w) * img_h * passSamples;
+
+	// A pass of one sample per pixel cannot tell its variance, and only
+	// counts until a pass that can comes.
+	double weight = variance < std::numeric_limits<double>::infinity() ? 1.0 / std::max(variance, 1e-12) : 0.0;
+	if (weights + weight == 0) {
+		for (int i = 0; i < img_w * img_h; i++)
+			image[i] = image[i] + pass[i];
+		return 0.0;
+	}
+
+	float imageScale = samples > 0 ? static_cast<float>(weights / (weights + weight) * (samples + passSamples) / samples) : 0.0f;
+	float passScale = static_cast<float>(weight / (weights + weight) * (samples + passSamples) / passSamples);
+	for (int i = 0; i < img_w * img_h; i++)
+		image[i] = image[i] * imageScale + pass[i] * passScale;
+	return weights + weight;
 }
 
 std::shared_ptr<Surface> GetScene01() {
@@ -274,16 +501,273 @@ std::shared_ptr<Surface> GetScene03() {
 	return pScene;
 }
 
-void monteCarlo(const std::string& output_name, const ::shared_ptr<Surface>& pScene, int img_w, int img_h, int tracing_scene, int effort) {
+std::shared_ptr<Surface> GetScene04() {
+	std::shared_ptr<Group> pScene(new Group());
+
+	// Add a light at the top wall.
+	std::shared_ptr<Wall> pTopLight(new Wall(Point3f(-4, 9.9f, 14), Point3f(4, 9.9f, 14), Point3f(4, 9.9f, 6), Point3f(-4, 9.9f, 6)));
+	std::shared_ptr<Material> pTopLightMaterial(new Material(RGBColor(0.0f, 0.0f, 0.0f)));
+	pTopLightMaterial->SetEmissionColor(RGBColor(20.0f, 20.0f, 20.0f));
+	pTopLightMaterial->SetReflectionType(Type::DIFF);
+	pTopLight->SetMaterial(pTopLightMaterial);
+	pScene->AddObject(pTopLight);
+
+	// Add a panel below the light, so that light only reaches the room
+	// through the gap between the panel and the right wall.
+	std::shared_ptr<Wall> pPanel(new Wall(Point3f(-10, 8, 20), Point3f(7, 8, 20), Point3f(7, 8, -20), Point3f(-10, 8, -20)));
+	std::shared_ptr<Material> pPanelMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pPanelMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pPanelMaterial->SetReflectionType(Type::DIFF);
+	pPanel->SetMaterial(pPanelMaterial);
+	pScene->AddObject(pPanel);
+
+	// Add a diffuse sphere into the scene.
+	std::shared_ptr<Sphere> pSphere(new Sphere(Point3f(-3.5f, -6.5f, 10), 3.5f /*radius*/));
+	std::shared_ptr<Material> pSphereMaterial(new Material(RGBColor(0.8f, 0.8f, 0.8f)));
+	pSphereMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pSphereMaterial->SetReflectionType(Type::DIFF);
+	pSphere->SetMaterial(pSphereMaterial);
+	pScene->AddObject(pSphere);
+
+	// Add the front wall.
+	std::shared_ptr<Wall> pFrontWall(new Wall(Point3f(-10, 10, -20), Point3f(10, 10, -20), Point3f(10, -10, -20), Point3f(-10, -10, -20)));
+	std::shared_ptr<Material> pFrontWallMaterial(new Material(RGBColor(0.5f, 0.5f, 0.5f)));
+	pFrontWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pFrontWallMaterial->SetReflectionType(Type::DIFF);
+	pFrontWall->SetMaterial(pFrontWallMaterial);
+	pScene->AddObject(pFrontWall);
+
+	// Add the back wall.
+	std::shared_ptr<Wall> pBackWall(new Wall(Point3f(10, 10, 20), Point3f(-10, 10, 20), Point3f(-10, -10, 20), Point3f(10, -10, 20)));
+	std::shared_ptr<Material> pBackWallMaterial(new Material(RGBColor(0.2f, 0.8f, 0.2f)));
+	pBackWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pBackWallMaterial->SetReflectionType(Type::DIFF);
+	pBackWall->SetMaterial(pBackWallMaterial);
+	pScene->AddObject(pBackWall);
+
+	// Add the top wall.
+	std::shared_ptr<Wall> pTopWall(new Wall(Point3f(-10, 10, 20), Point3f(10, 10, 20), Point3f(10, 10, -20), Point3f(-10, 10, -20)));
+	std::shared_ptr<Material> pTopWallMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pTopWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pTopWallMaterial->SetReflectionType(Type::DIFF);
+	pTopWall->SetMaterial(pTopWallMaterial);
+	pScene->AddObject(pTopWall);
+
+	// Add the bottom wall.
+	std::shared_ptr<Wall> pBottomWall(new Wall(Point3f(10, -10, 20), Point3f(-10, -10, 20), Point3f(-10, -10, -20), Point3f(10, -10, -20)));
+	std::shared_ptr<Material> pBottomWallMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pBottomWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pBottomWallMaterial->SetReflectionType(Type::DIFF);
+	pBottomWall->SetMaterial(pBottomWallMaterial);
+	pScene->AddObject(pBottomWall);
+
+	// Add the left wall.
+	std::shared_ptr<Wall> pLeftWall(new Wall(Point3f(-10, -10, 20), Point3f(-10, 10, 20), Point3f(-10, 10, -20), Point3f(-10, -10, -20)));
+	std::shared_ptr<Material> pLeftWallMaterial(new Material(RGBColor(0.8f, 0.2f, 0.2f)));
+	pLeftWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pLeftWallMaterial->SetReflectionType(Type::DIFF);
+	pLeftWall->SetMaterial(pLeftWallMaterial);
+	pScene->AddObject(pLeftWall);
+
+	// Add the right wall.
+	std::shared_ptr<Wall> pRightWall(new Wall(Point3f(10, 10, 20), Point3f(10, -10, 20), Point3f(10, -10, -20), Point3f(10, 10, -20)));
+	std::shared_ptr<Material> pRightWallMaterial(new Material(RGBColor(0.2f, 0.2f, 0.8f)));
+	pRightWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pRightWallMaterial->SetReflectionType(Type::DIFF);
+	pRightWall->SetMaterial(pRightWallMaterial);
+	pScene->AddObject(pRightWall);
+
+	return pScene;
+}
+
+std::shared_ptr<Surface> GetScene05() {
+	std::shared_ptr<Group> pScene(new Group());
+
+	// Add a grid of small colored lights at the top wall.
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 8; j++) {
+			float x = -9.0f + 2.25f * i;
+			float z = 1.0f + 2.25f * j;
+			std::shared_ptr<Wall> pLight(new Wall(Point3f(x, 9.9f, z + 1), Point3f(x + 1, 9.9f, z + 1), Point3f(x + 1, 9.9f, z), Point3f(x, 9.9f, z)));
+			std::shared_ptr<Material> pLightMaterial(new Material(RGBColor(0.0f, 0.0f, 0.0f)));
+			pLightMaterial->SetEmissionColor(RGBColor(0.02f + 0.01f * i, 0.05f, 0.09f - 0.01f * j));
+			pLightMaterial->SetReflectionType(Type::DIFF);
+			pLight->SetMaterial(pLightMaterial);
+			pScene->AddObject(pLight);
+		}
+	}
+
+	// Add a diffuse sphere into the scene.
+	std::shared_ptr<Sphere> pSphere(new Sphere(Point3f(2.0f, -6.0f, 10), 4.0f /*radius*/));
+	std::shared_ptr<Material> pSphereMaterial(new Material(RGBColor(0.8f, 0.8f, 0.8f)));
+	pSphereMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pSphereMaterial->SetReflectionType(Type::DIFF);
+	pSphere->SetMaterial(pSphereMaterial);
+	pScene->AddObject(pSphere);
+
+	// Add the front wall.
+	std::shared_ptr<Wall> pFrontWall(new Wall(Point3f(-10, 10, -20), Point3f(10, 10, -20), Point3f(10, -10, -20), Point3f(-10, -10, -20)));
+	std::shared_ptr<Material> pFrontWallMaterial(new Material(RGBColor(0.5f, 0.5f, 0.5f)));
+	pFrontWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pFrontWallMaterial->SetReflectionType(Type::DIFF);
+	pFrontWall->SetMaterial(pFrontWallMaterial);
+	pScene->AddObject(pFrontWall);
+
+	// Add the back wall.
+	std::shared_ptr<Wall> pBackWall(new Wall(Point3f(10, 10, 20), Point3f(-10, 10, 20), Point3f(-10, -10, 20), Point3f(10, -10, 20)));
+	std::shared_ptr<Material> pBackWallMaterial(new Material(RGBColor(0.2f, 0.8f, 0.2f)));
+	pBackWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pBackWallMaterial->SetReflectionType(Type::DIFF);
+	pBackWall->SetMaterial(pBackWallMaterial);
+	pScene->AddObject(pBackWall);
+
+	// Add the top wall.
+	std::shared_ptr<Wall> pTopWall(new Wall(Point3f(-10, 10, 20), Point3f(10, 10, 20), Point3f(10, 10, -20), Point3f(-10, 10, -20)));
+	std::shared_ptr<Material> pTopWallMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pTopWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pTopWallMaterial->SetReflectionType(Type::DIFF);
+	pTopWall->SetMaterial(pTopWallMaterial);
+	pScene->AddObject(pTopWall);
+
+	// Add the bottom wall.
+	std::shared_ptr<Wall> pBottomWall(new Wall(Point3f(10, -10, 20), Point3f(-10, -10, 20), Point3f(-10, -10, -20), Point3f(10, -10, -20)));
+	std::shared_ptr<Material> pBottomWallMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pBottomWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pBottomWallMaterial->SetReflectionType(Type::DIFF);
+	pBottomWall->SetMaterial(pBottomWallMaterial);
+	pScene->AddObject(pBottomWall);
+
+	// Add the left wall.
+	std::shared_ptr<Wall> pLeftWall(new Wall(Point3f(-10, -10, 20), Point3f(-10, 10, 20), Point3f(-10, 10, -20), Point3f(-10, -10, -20)));
+	std::shared_ptr<Material> pLeftWallMaterial(new Material(RGBColor(0.8f, 0.2f, 0.2f)));
+	pLeftWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pLeftWallMaterial->SetReflectionType(Type::DIFF);
+	pLeftWall->SetMaterial(pLeftWallMaterial);
+	pScene->AddObject(pLeftWall);
+
+	// Add the right wall.
+	std::shared_ptr<Wall> pRightWall(new Wall(Point3f(10, 10, 20), Point3f(10, -10, 20), Point3f(10, -10, -20), Point3f(10, 10, -20)));
+	std::shared_ptr<Material> pRightWallMaterial(new Material(RGBColor(0.2f, 0.2f, 0.8f)));
+	pRightWallMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pRightWallMaterial->SetReflectionType(Type::DIFF);
+	pRightWall->SetMaterial(pRightWallMaterial);
+	pScene->AddObject(pRightWall);
+
+	return pScene;
+}
+
+std::shared_ptr<Surface> GetScene06() {
+	std::shared_ptr<Group> pScene(new Group());
+
+	// Add a diffuse sphere into the scene.
+	std::shared_ptr<Sphere> pSphere(new Sphere(Point3f(-5.0f, -6.0f, 12), 4.0f /*radius*/));
+	std::shared_ptr<Material> pSphereMaterial(new Material(RGBColor(0.8f, 0.3f, 0.2f)));
+	pSphereMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pSphereMaterial->SetReflectionType(Type::DIFF);
+	pSphere->SetMaterial(pSphereMaterial);
+	pScene->AddObject(pSphere);
+
+	// Add a reflective sphere into the scene.
+	std::shared_ptr<Sphere> pMirrorSphere(new Sphere(Point3f(5.0f, -6.0f, 16), 4.0f /*radius*/));
+	std::shared_ptr<Material> pMirrorSphereMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pMirrorSphereMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pMirrorSphereMaterial->SetReflectionType(Type::SPEC);
+	pMirrorSphere->SetMaterial(pMirrorSphereMaterial);
+	pScene->AddObject(pMirrorSphere);
+
+	// Add a glass sphere into the scene.
+	std::shared_ptr<Sphere> pGlassSphere(new Sphere(Point3f(1.0f, -7.5f, 5.0f), 2.5f /*radius*/));
+	std::shared_ptr<Material> pGlassSphereMaterial(new Material(RGBColor(0.95f, 0.95f, 0.95f)));
+	pGlassSphereMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pGlassSphereMaterial->SetReflectionType(Type::REFR);
+	pGlassSphereMaterial->SetRefrIndex(1.5f, 1.0f);
+	pGlassSphere->SetMaterial(pGlassSphereMaterial);
+	pScene->AddObject(pGlassSphere);
+
+	// Add the ground, stretching out to the horizon.
+	std::shared_ptr<Wall> pGround(new Wall(Point3f(500, -10, 500), Point3f(-500, -10, 500), Point3f(-500, -10, -500), Point3f(500, -10, -500)));
+	std::shared_ptr<Material> pGroundMaterial(new Material(RGBColor(0.6f, 0.6f, 0.55f)));
+	pGroundMaterial->SetEmissionColor(RGBColor(0.0f, 0.0f, 0.0f));
+	pGroundMaterial->SetReflectionType(Type::DIFF);
+	pGround->SetMaterial(pGroundMaterial);
+	pScene->AddObject(pGround);
+
+	return pScene;
+}
+
+// A blue sky that fades to white at the horizon, with a small bright sun
+// behind the camera, for scene 6.
+std::shared_ptr<EnvironmentMap> GetSky06() {
+	const int width = 512;
+	const int height = 256;
+	Vector3f sun(-0.4f, 0.6f, -0.7f);
+	sun.Normalize();
+
+	std::vector<RGBColor> texels(width * height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float theta = static_cast<float>(M_PI) * (y + 0.5f) / height;
+			float phi = static_cast<float>(2 * M_PI) * (x + 0.5f) / width - static_cast<float>(M_PI);
+			Vector3f dir(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+			RGBColor color;
+			if (dir.y > 0) {
+				float t = sqrt(dir.y);
+				color = RGBColor(0.9f, 0.9f, 0.95f) * (1 - t) + RGBColor(0.25f, 0.45f, 0.9f) * t;
+			}
+			else {
+				color = RGBColor(0.2f, 0.18f, 0.15f);
+			}
+			if (dot(dir, sun) > 0.9985f)
+				color = RGBColor(250.0f, 230.0f, 200.0f);
+			texels[y * width + x] = color;
+		}
+	}
 
-	float planeMinX = -10.0f;
-	float planeMaxX = 10.0f;
-	float planeMinY = -10.0f;
-	float planeMaxY = 10.0f;
+	return std::shared_ptr<EnvironmentMap>(new EnvironmentMap(width, height, texels));
+}
 
-	float view_radius = (planeMaxX - planeMinX) / img_w / 2.0f;
-	float d = 20.0;           // Distance between the viewpoint and the image plane
-	Point3f e(0, 0, -20.0);   // Viewpoint
+// Render the image and save it as 'output_name'. Return false if
+// options.fCheckAllocations is set and tracing allocated heap memory after
+// the first pass.
+bool monteCarlo(const std::string& output_name, const Scene& scene, int img_w, int img_h, int tracing_scene, int effort,
+	const RenderOptions& options) {
+
+	Camera camera(img_w, img_h);
+	BDPT bdpt(scene, camera);
+	PhotonMapper photonMapper(scene, camera);
+	IrradianceCache irradianceCache(scene.GetRoot().GetBounds(), IRRADIANCE_CACHE_ERROR);
+	bool fUseIrradianceCache = options.fIrradianceCache && options.integrator == Integrator::PATH && shadingMode == ShadingMode::SLOW;
+	PathGuide pathGuide(scene.GetRoot().GetBounds());
+	bool fUsePathGuide = options.fPathGuiding && options.integrator == Integrator::PATH && shadingMode == ShadingMode::COSINE;
+	bool fUseReSTIR = (options.fReSTIR || options.fReSTIRTemporal) && options.integrator == Integrator::PATH && shadingMode == ShadingMode::FAST;
+	// Both hold a few words per pixel, so they are only made when used.
+	std::unique_ptr<ReSTIR> restir;
+	if (fUseReSTIR)
+		restir.reset(new ReSTIR(scene, camera, img_w, img_h, options.fReSTIRTemporal));
+	std::unique_ptr<SplatBuffer> splats;	// light paths' contributions to the pixels they reach
+	if (options.integrator == Integrator::BDPT)
+		splats.reset(new SplatBuffer(img_w, img_h));
+	bool fPerPixelSamples = options.integrator == Integrator::PATH && !fUsePathGuide && !fUseReSTIR;
+	bool fAdaptive = options.targetError > 0 && fPerPixelSamples;
+	bool fTimeBudget = options.timeBudget > 0 && fPerPixelSamples;
+	std::unique_ptr<VarianceBuffer> stats;	// samples of every pixel, when they are not all the same
+	std::vector<char> active;			// pixels adaptive sampling takes more samples of in this pass
+	int activePixels = img_w * img_h;
+	if (fAdaptive || fTimeBudget)
+		stats.reset(new VarianceBuffer(img_w, img_h));
+	if (fAdaptive)
+		active.assign(img_w * img_h, 1);
+	// Guided passes are weighted by their variance, so each is summed apart
+	// from the image before it is added to it.
+	std::vector<RGBColor> passImage;
+	std::unique_ptr<VarianceBuffer> passStats;	// samples of every pixel in this pass
+	double passWeights = 0.0;
+	if (fUsePathGuide)
+		passImage.resize(img_w * img_h);
+	std::unique_ptr<BlueNoiseMask> blueNoise;
+	if (options.sampler == SamplerType::BLUE_NOISE)
+		blueNoise.reset(new BlueNoiseMask(BLUE_NOISE_SIZE));
 
 	// Allocate intermediate image.
 	RGBColor *i_image = (RGBColor *)malloc(img_w * img_h * sizeof(RGBColor));
@@ -293,57 +777,355 @@ void monteCarlo(const std::string& output_name, const ::shared_ptr<Surface>& pSc
 		}
 	}
 
-	#pragma omp parallel
-	{
-		int i = omp_get_thread_num();
-		printf_s("Hello from thread %d\n", i);
+	unsigned long long paths = 0;
+	unsigned long long segments = 0;
+
+	// Photon mapping renders in passes of equal size, each with a new photon
+	// map. Path guiding renders in passes that double in size, learning from
+	// each one for the next. Reservoir resampling takes one sample per pixel
+	// per pass. Otherwise every sample is taken in a single pass.
+	std::vector<int> passEfforts;
+	if (options.integrator == Integrator::PHOTON) {
+		int passes = std::max(1, std::min(options.photonPasses, effort));
+		for (int pass = 0; pass < passes; pass++)
+			passEfforts.push_back(effort * (pass + 1) / passes - effort * pass / passes);
 	}
-
-	int count = 0;
+	else if (fUsePathGuide) {
+		for (int remaining = effort, size = 1; remaining > 0; size *= 2) {
+			// Fold a last pass smaller than the next size into this one.
+			int passEffort = remaining < size * 3 ? remaining : size;
+			passEfforts.push_back(passEffort);
+			remaining -= passEffort;
+		}
+	}
+	else if (fUseReSTIR) {
+		// One frame of reservoirs per sample.
+		passEfforts.assign(effort, 1);
+	}
+	else if (fAdaptive) {
+		// A few samples everywhere, then passes that double the samples of
+		// the pixels that need more for the target error.
+		for (int done = 0; done < effort; done += passEfforts.back())
+			passEfforts.push_back(std::min(done == 0 ? ADAPTIVE_MIN_SAMPLES : done, effort - done));
+	}
+	else if (!options.convergence_name.empty() || options.snapshotSeconds > 0 || options.snapshotPasses > 0 ||
+		options.fCheckAllocations) {
+		// Passes that double the samples so far, to measure the error or
+		// write the image after each of them, or to count the allocations
+		// once the first one has grown every buffer.
+		for (int done = 0; done < effort; done += passEfforts.back())
+			passEfforts.push_back(std::min(std::max(done, 1), effort - done));
+	}
+	else {
+		passEfforts.push_back(effort);
+	}
+	// With a time budget or a snapshot interval to keep to, passes that double
+	// the samples so far are sized when they start instead.
+	bool fSizedPasses = fTimeBudget || (options.snapshotSeconds > 0 && options.integrator != Integrator::PHOTON &&
+		!fUsePathGuide && !fUseReSTIR);
+	int passes = fSizedPasses ? effort : static_cast<int>(passEfforts.size());
+
+	SimpleImage convergenceReference;
+	std::ofstream convergence;
+	if (!options.convergence_name.empty()) {
+		if (options.reference_name.empty()) {
+			cerr << "Error: --convergence needs a --reference image." << endl;
+		}
+		else {
+			convergenceReference.load(options.reference_name);
+			if (convergenceReference.width() != img_w || convergenceReference.height() != img_h) {
+				cerr << "Error: reference image size does not match the output." << endl;
+			}
+			else {
+				convergence.open(options.convergence_name.c_str());
+				convergence << "samples,seconds,rmse" << endl;
+			}
+		}
+	}
+	double outputTime = 0.0;			// spent measuring the error and writing snapshots, not rendering
+	int passStart = 0;					// samples per pixel before this pass
 
 	double wall0 = get_wall_time();
 	double cpu0 = get_cpu_time();
+	double deadline = wall0 + options.timeBudget;
+	double lastSnapshot = wall0;		// when the image so far was last written
+	// Every thread keeps its context, and so its scratch arena, from one
+	// pass to the next.
+	std::vector<std::unique_ptr<ThreadContext> > contexts(omp_get_max_threads());
+	std::vector<std::unique_ptr<Sampler> > samplers(omp_get_max_threads());
+	for (size_t i = 0; i < contexts.size(); i++) {
+		contexts[i].reset(new ThreadContext());
+		samplers[i].reset(CreateSampler(options.sampler, options.seed, contexts[i]->rng, blueNoise.get()));
+		contexts[i]->sampler = samplers[i].get();
+		if (fUseIrradianceCache)
+			contexts[i]->irradianceCache = &irradianceCache;
+		if (fUsePathGuide)
+			contexts[i]->pathGuide = &pathGuide;
+	}
+	long long allocations = 0;			// made while tracing after the first pass
+	int cacheBlocks = 0;				// of them, blocks of irradiance cache records
+
+	// Adaptive sampling can stop before every pixel has 'effort' samples, and
+	// then ends ahead of the progress reported.
+	ProgressReporter progress(options.fQuiet, static_cast<unsigned long long>(effort) * img_w * img_h, fTimeBudget ? deadline : 0.0);
+
+	for (int pass = 0; pass < passes; pass++) {
+		int passEffort;
+		bool fSnapshotNext = false;			// the pass is cut short to end at the next snapshot
+		if (fSizedPasses) {
+			// Double the samples so far, but no more than the time left to the
+			// deadline or the next snapshot allows at the speed of the passes
+			// so far. A snapshot pass takes at least one sample.
+			double now = get_wall_time();
+			int firstEffort = fAdaptive ? ADAPTIVE_MIN_SAMPLES : 1;
+			passEffort = std::min(passStart == 0 ? firstEffort : passStart, effort - passStart);
+			if (pass > 0 && paths > 0) {
+				double secondsPerSample = (now - wall0 - outputTime) / paths;
+				if (fTimeBudget)
+					passEffort = std::min(passEffort, static_cast<int>((deadline - now) / (secondsPerSample * activePixels)));
+				if (options.snapshotSeconds > 0) {
+					int snapshotEffort = std::max(1, static_cast<int>((lastSnapshot + options.snapshotSeconds - now) / (secondsPerSample * activePixels)));
+					fSnapshotNext = snapshotEffort < passEffort;
+					passEffort = std::min(passEffort, snapshotEffort);
+				}
+			}
+			if ((fTimeBudget && now >= deadline) || passEffort <= 0)
+				break;
+		}
+		else {
+			passEffort = passEfforts[pass];
+		}
+		// Tiles go to the threads as they ask for them, so that threads with
+		// cheap tiles take over the others' work instead of waiting for them.
+		TileScheduler tiles(img_w, img_h, TILE_SIZE, omp_get_max_threads());
+		TileScheduler restirTiles(img_w, img_h, TILE_SIZE, omp_get_max_threads());
+		float radius = PhotonMapper::GetPassRadius(options.photonRadius, pass);
+		if (options.integrator == Integrator::PHOTON)
+			photonMapper.EmitPhotons(options.photons, options.seed + pass + 1);
+		RGBColor *sums = i_image;		// where the tiles add their samples
+		if (fUsePathGuide) {
+			std::fill(passImage.begin(), passImage.end(), RGBColor());
+			passStats.reset(new VarianceBuffer(img_w, img_h));
+			sums = &passImage[0];
+		}
 
-	// Generate ray based on effort for each pixel and trace for the pixel's color.
-	#pragma omp parallel for
-	for (int h = 0; h < img_h; h++) {
-		for (int w = 0; w < img_w; w++) {
+		// Generate ray based on effort for each pixel and trace for the pixel's color.
+		#pragma omp parallel
+		{
+			int worker = omp_get_thread_num();
+			Tile tile;
+			// Sums of the samples of the current tile, added to the image once it is done.
+			std::vector<RGBColor> tileImage(TILE_SIZE * TILE_SIZE);
+
+			// Every pixel sample draws from a stream of its own, reseeded below.
+			ThreadContext& ctx = *contexts[worker];
+			ctx.paths = 0;
+			ctx.segments = 0;
+
+			// Count the allocations of every thread while they trace, from the
+			// second pass on.
+			bool fCounting = options.fCheckAllocations && pass > 0;
+			int cacheBlocks0 = irradianceCache.GetBlockCount();
+			#pragma omp barrier
+			#pragma omp single
+			{
+				if (fCounting)
+					StartCountingAllocations();
+			}
 
-			// w and h are in image coordinate, need to convert them into the scene coordinate.
-			float x_anch = getSceneX(w, img_w, planeMinX, planeMaxX);
-			float y_anch = getSceneY(h, img_h, planeMinY, planeMaxY);
+			if (fUseReSTIR) {
+				// Every pixel draws its light candidates before any pixel reuses
+				// its neighbours' ones.
+				while (restirTiles.Next(worker, &tile)) {
+					for (int h = tile.y0; h < tile.y1; h++) {
+						for (int w = tile.x0; w < tile.x1; w++) {
+							ctx.rng.Seed(options.seed, pixelStream(w, h, img_w, img_h, passStart, 0));
+							restir->SamplePixel(ctx, w, h);
+						}
+					}
+				}
+
+				#pragma omp barrier
+
+				while (tiles.Next(worker, &tile)) {
+					unsigned long long tilePaths = ctx.paths;
+					for (int h = tile.y0; h < tile.y1; h++) {
+						for (int w = tile.x0; w < tile.x1; w++) {
+							ctx.rng.Seed(options.seed, pixelStream(w, h, img_w, img_h, passStart, 1));
+							ctx.sampler->StartPixelSample(w, h, passStart);
+							*(i_image + h * img_w + w) = *(i_image + h * img_w + w) + restir->ShadePixel(ctx, w, h);
+							ctx.paths++;
+						}
+					}
+					progress.AddTile(ctx.paths - tilePaths);
+				}
+			}
+			else {
+				// Past the deadline, the threads take no more tiles, and the tiles
+				// being rendered finish. The first pass always covers every pixel,
+				// so that none is left black.
+				while (!(fTimeBudget && pass > 0 && get_wall_time() >= deadline) && tiles.Next(worker, &tile)) {
+					unsigned long long tilePaths = ctx.paths;
+					int tileWidth = tile.x1 - tile.x0;
+					std::fill(tileImage.begin(), tileImage.end(), RGBColor());
+					for (int h = tile.y0; h < tile.y1; h++) {
+						for (int w = tile.x0; w < tile.x1; w++) {
+							RGBColor& sum = tileImage[(h - tile.y0) * tileWidth + w - tile.x0];
+
+							// Pixels whose samples can differ continue from their own ones.
+							int pixelStart = passStart;
+							int pixelEffort = passEffort;
+							if (fAdaptive && !active[h * img_w + w])
+								continue;
+							if (stats) {
+								pixelStart = stats->GetCount(w, h);
+								pixelEffort = std::min(passEffort, effort - pixelStart);
+							}
+
+							for (int iter = 0; iter < pixelEffort; iter++) {
+								ctx.rng.Seed(options.seed, pixelStream(w, h, img_w, img_h, pixelStart + iter, 0));
+								ctx.sampler->StartPixelSample(w, h, pixelStart + iter);
+								RGBColor color;
+								if (options.integrator == Integrator::BDPT) {
+									color = bdpt.Trace(ctx, w, h, *splats);
+								}
+								else if (options.integrator == Integrator::PHOTON) {
+									color = photonMapper.Trace(ctx, w, h, radius);
+								}
+								else {
+									float u1, u2;
+									ctx.sampler->Get2D(&u1, &u2);
+									Ray ray = camera.GenerateRay(w, h, u1, u2);
+									color = ray.traceForColor(scene, ctx, 0 /*depth*/, RGBColor(1.0f, 1.0f, 1.0f) /*throughput*/, false /*fHitDiffuse*/);
+								}
+								sum = sum + color;
+								if (stats)
+									stats->Add(w, h, color);
+								if (passStats)
+									passStats->Add(w, h, color);
+								ctx.paths++;
+							}
+						}
+					}
+
+					for (int h = tile.y0; h < tile.y1; h++) {
+						for (int w = tile.x0; w < tile.x1; w++)
+							*(sums + h * img_w + w) = *(sums + h * img_w + w) + tileImage[(h - tile.y0) * tileWidth + w - tile.x0];
+					}
+					progress.AddTile(ctx.paths - tilePaths);
+				}
+			}
 
-			for (int iter = 0; iter < effort; iter++) {
-				float x = frand_radius(view_radius) + x_anch;
-				float y = frand_radius(view_radius) + y_anch;
+			#pragma omp barrier
+			#pragma omp single
+			{
+				if (fCounting) {
+					allocations += StopCountingAllocations();
+					cacheBlocks += irradianceCache.GetBlockCount() - cacheBlocks0;
+				}
+			}
 
-				Vector3f rayDir = Vector3f(x - e.x, y - e.y, d);
-				Ray ray(e, rayDir);
-				*(i_image + h * img_w + w) = *(i_image + h * img_w + w) + ray.traceForColor(*pScene, 0 /*depth*/, 1.0 /*prob*/, false /*fHitDiffuse*/);
+			#pragma omp critical
+			{
+				paths += ctx.paths;
+				segments += ctx.segments;
 			}
-			*(i_image + h * img_w + w) = *(i_image + h * img_w + w) * (1.0f / effort);
 		}
 
-		#pragma omp atomic
-		count++;
+		if (fUsePathGuide) {
+			pathGuide.Refine();
+			passWeights = addWeightedPass(i_image, &passImage[0], *passStats, img_w, img_h, passStart, passEffort, passWeights);
+		}
+		if (fUseReSTIR)
+			restir->NextFrame();
+		passStart += passEffort;
+		if (fSizedPasses && passStart >= effort)
+			passes = pass + 1;
+
+		// Stop once no pixel needs more samples.
+		if (fAdaptive && pass < passes - 1) {
+			activePixels = markActivePixels(*stats, options.targetError, effort, img_w, img_h, &active);
+			if (!options.fQuiet)
+				cout << "Adaptive sampling: " << activePixels << " pixels need more samples." << endl;
+			if (activePixels == 0)
+				passes = pass + 1;
+		}
+
+		// Record the error whenever the samples per pixel reach a power of two,
+		// and after every pass when pixels can have different samples, against
+		// the average samples per pixel.
+		if (convergence.is_open() && ((passStart & (passStart - 1)) == 0 || stats || pass == passes - 1)) {
+			double time0 = get_wall_time();
+			float rmse = computeRMSE(resolveImage(i_image, splats.get(), img_w, img_h, passStart, stats.get()), convergenceReference);
+			convergence << static_cast<double>(paths) / (img_w * img_h) << "," << time0 - wall0 - outputTime << "," << rmse << endl;
+			outputTime += get_wall_time() - time0;
+		}
 
-		std::cout << "Progress: " << count << "/" << img_h << " completed." << std::endl;
+		// Write the image so far over the output file, which the final image
+		// replaces at the end.
+		bool fSnapshotDue = (options.snapshotPasses > 0 && (pass + 1) % options.snapshotPasses == 0) || fSnapshotNext ||
+			(options.snapshotSeconds > 0 && get_wall_time() - lastSnapshot >= options.snapshotSeconds);
+		if (fSnapshotDue && pass < passes - 1) {
+			double time0 = get_wall_time();
+			SimpleImage snapshot = resolveImage(i_image, splats.get(), img_w, img_h, passStart, stats.get());
+			saveReplacing(snapshot, output_name);
+			if (!options.fQuiet)
+				cout << "Snapshot: " << static_cast<double>(paths) / (img_w * img_h) << " samples per pixel written to " << output_name << endl;
+			lastSnapshot = get_wall_time();
+			outputTime += lastSnapshot - time0;
+		}
 	}
 
-	double wall1 = get_wall_time();
-	double cpu1 = get_cpu_time();
+	progress.Stop();
+	double wall1 = get_wall_time() - outputTime;
+	double cpu1 = get_cpu_time() - outputTime;
+	cout << "Seed      = " << options.seed << endl;
 	cout << "Wall Time = " << wall1 - wall0 << endl;
 	cout << "CPU Time  = " << cpu1 - cpu0 << endl;
-
-	SimpleImage result(img_w, img_h, RGBColor(0, 0, 0));
-	for (int h = 0; h < img_h; h++) {
-		for (int w = 0; w < img_w; w++) {
-			result.set(w, h, *(i_image + h * img_w + w));
+	cout << "Samples/s = " << (double)paths / (wall1 - wall0) << endl;
+	if (stats)
+		cout << "Avg samples/pixel = " << (double)paths / (img_w * img_h) << endl;
+	cout << "Avg path length = " << (double)segments / paths << endl;
+	if (fUseIrradianceCache)
+		cout << "Irradiance records = " << irradianceCache.GetRecordCount() << endl;
+	if (fUsePathGuide)
+		cout << "Guiding cells = " << pathGuide.GetCellCount() << endl;
+
+	// The irradiance cache keeps its records for the whole render, and takes
+	// them from the heap a block at a time: those blocks are its output, not
+	// memory tracing could reuse, so they do not fail the check.
+	bool fPassed = true;
+	if (options.fCheckAllocations) {
+		if (passes < 2) {
+			cerr << "Error: --check-allocations needs two passes or more: an effort of 2 or more, and with photon" << endl;
+			cerr << "       mapping --photon-passes 2 or more." << endl;
+			fPassed = false;
+		}
+		else {
+			cout << "Allocations while tracing after the first pass = " << allocations << endl;
+			if (cacheBlocks > 0)
+				cout << "  of them blocks of irradiance cache records = " << cacheBlocks << endl;
+			fPassed = allocations == cacheBlocks;
 		}
 	}
 
+	// Light tracing contributions can only be added once every thread is done.
+	SimpleImage result = resolveImage(i_image, splats.get(), img_w, img_h, effort, stats.get());
+
 	free(i_image);
-	result.save(output_name);
+	saveReplacing(result, output_name);
+
+	if (!options.reference_name.empty()) {
+		SimpleImage reference(options.reference_name);
+		if (reference.width() != img_w || reference.height() != img_h) {
+			cerr << "Error: reference image size does not match the output." << endl;
+		}
+		else {
+			cout << "RMSE      = " << computeRMSE(result, reference) << endl;
+		}
+	}
+
+	return fPassed;
 }
 
 int main(int argc, char **argv) {
@@ -357,15 +1139,17 @@ int main(int argc, char **argv) {
 	int tracing_scene = 1;
 	int effort = 100;
 	int threads = sysinfo.dwNumberOfProcessors;
+	RenderOptions options;
 
 	if (argc != 1) {
-		if (argc == 8) {
+		if (argc >= 8) {
 			output_file = argv[1];
 			imgWidth = atoi(argv[2]);
 			imgHeight = atoi(argv[3]);
 			tracing_scene = atoi(argv[4]);
 			effort = atoi(argv[5]);
-			fUseFastShading = atoi(argv[6]) == 1;
+			int diffuse = atoi(argv[6]);
+			shadingMode = diffuse == 1 ? ShadingMode::FAST : diffuse == 2 ? ShadingMode::COSINE : ShadingMode::SLOW;
 			int _threads = atoi(argv[7]);
 
 			if (_threads < 0) threads += _threads;
@@ -373,6 +1157,115 @@ int main(int argc, char **argv) {
 
 			if (threads <= 0) threads = 1;
 			else if (static_cast<unsigned>(threads) > sysinfo.dwNumberOfProcessors) threads = sysinfo.dwNumberOfProcessors;
+
+			// Previews have too few samples for a low-discrepancy sequence to
+			// help, but spreading their error as blue noise does.
+			if (effort <= PREVIEW_EFFORT)
+				options.sampler = SamplerType::BLUE_NOISE;
+
+			for (int i = 8; i < argc; i++) {
+				std::string option = argv[i];
+				if (option == "--reference" && i + 1 < argc) {
+					options.reference_name = argv[++i];
+				}
+				else if (option == "--sampler" && i + 1 < argc) {
+					std::string name = argv[++i];
+					if (name == "independent") {
+						options.sampler = SamplerType::INDEPENDENT;
+					}
+					else if (name == "halton") {
+						options.sampler = SamplerType::HALTON;
+					}
+					else if (name == "sobol") {
+						options.sampler = SamplerType::SOBOL;
+					}
+					else if (name == "bluenoise") {
+						options.sampler = SamplerType::BLUE_NOISE;
+					}
+					else {
+						usage_message();
+						return 1;
+					}
+				}
+				else if (option == "--convergence" && i + 1 < argc) {
+					options.convergence_name = argv[++i];
+				}
+				else if (option == "--environment" && i + 1 < argc) {
+					options.environment_name = argv[++i];
+				}
+				else if (option == "--quiet") {
+					options.fQuiet = true;
+				}
+				else if (option == "--check-allocations") {
+					options.fCheckAllocations = true;
+				}
+				else if (option == "--min-depth" && i + 1 < argc) {
+					minPathDepth = atoi(argv[++i]);
+				}
+				else if (option == "--max-depth" && i + 1 < argc) {
+					maxPathDepth = atoi(argv[++i]);
+				}
+				else if (option == "--stochastic-fresnel") {
+					fStochasticFresnel = true;
+				}
+				else if (option == "--irradiance-cache") {
+					options.fIrradianceCache = true;
+				}
+				else if (option == "--guiding") {
+					options.fPathGuiding = true;
+				}
+				else if (option == "--restir") {
+					options.fReSTIR = true;
+				}
+				else if (option == "--restir-temporal") {
+					options.fReSTIRTemporal = true;
+				}
+				else if (option == "--target-error" && i + 1 < argc) {
+					options.targetError = static_cast<float>(atof(argv[++i]));
+				}
+				else if (option == "--time-budget" && i + 1 < argc) {
+					options.timeBudget = atof(argv[++i]);
+				}
+				else if (option == "--snapshot-seconds" && i + 1 < argc) {
+					options.snapshotSeconds = atof(argv[++i]);
+				}
+				else if (option == "--snapshot-passes" && i + 1 < argc) {
+					options.snapshotPasses = std::max(0, atoi(argv[++i]));
+				}
+				else if (option == "--seed" && i + 1 < argc) {
+					options.seed = strtoull(argv[++i], nullptr, 10);
+					options.fFixedSeed = true;
+				}
+				else if (option == "--photons" && i + 1 < argc) {
+					options.photons = std::max(1, atoi(argv[++i]));
+				}
+				else if (option == "--photon-radius" && i + 1 < argc) {
+					options.photonRadius = static_cast<float>(atof(argv[++i]));
+				}
+				else if (option == "--photon-passes" && i + 1 < argc) {
+					options.photonPasses = std::max(1, atoi(argv[++i]));
+				}
+				else if (option == "--integrator" && i + 1 < argc) {
+					std::string name = argv[++i];
+					if (name == "path") {
+						options.integrator = Integrator::PATH;
+					}
+					else if (name == "bdpt") {
+						options.integrator = Integrator::BDPT;
+					}
+					else if (name == "photon") {
+						options.integrator = Integrator::PHOTON;
+					}
+					else {
+						usage_message();
+						return 1;
+					}
+				}
+				else {
+					usage_message();
+					return 1;
+				}
+			}
 		}
 		else {
 			usage_message();
@@ -380,9 +1273,26 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (minPathDepth < 0) minPathDepth = 0;
+	if (maxPathDepth < minPathDepth) maxPathDepth = minPathDepth;
+
+	// Only plain path tracing takes every pixel's samples on their own, which
+	// adaptive sampling needs to give pixels different numbers of them, and a
+	// time budget to stop part way through a pass.
+	bool fPlainPath = options.integrator == Integrator::PATH && !options.fPathGuiding && !options.fReSTIR && !options.fReSTIRTemporal;
+	if (options.targetError > 0 && !fPlainPath) {
+		cerr << "Error: --target-error only works with path tracing, without --guiding or --restir." << endl;
+		return 1;
+	}
+	if (options.timeBudget > 0 && !fPlainPath) {
+		cerr << "Error: --time-budget only works with path tracing, without --guiding or --restir." << endl;
+		return 1;
+	}
+
 	omp_set_num_threads(threads);
 
-	srand(static_cast<unsigned>(time(NULL)));
+	if (!options.fFixedSeed)
+		options.seed = static_cast<unsigned long long>(time(NULL));
 
 	// Get the scene based on the scene number.
 	std::shared_ptr<Surface> pScene;
@@ -395,11 +1305,33 @@ int main(int argc, char **argv) {
 	else if (tracing_scene == 3) {
 		pScene = GetScene03();
 	}
+	else if (tracing_scene == 4) {
+		pScene = GetScene04();
+	}
+	else if (tracing_scene == 5) {
+		pScene = GetScene05();
+	}
+	else if (tracing_scene == 6) {
+		pScene = GetScene06();
+	}
 	else {
 		pScene = GetScene01();
 	}
 
-	monteCarlo(output_file, pScene, imgWidth, imgHeight, tracing_scene, effort);
+	std::shared_ptr<EnvironmentMap> pEnvironment;
+	if (!options.environment_name.empty())
+		pEnvironment.reset(new EnvironmentMap(options.environment_name));
+	else if (tracing_scene == 6)
+		pEnvironment = GetSky06();
+
+	// Precompute the per-scene data, such as the light table, once.
+	Scene scene(pScene, pEnvironment);
+
+	bool fPassed = monteCarlo(output_file, scene, imgWidth, imgHeight, tracing_scene, effort, options);
+	if (options.fCheckAllocations) {
+		cout << (fPassed ? "Allocation check passed." : "Allocation check failed.") << endl;
+		return fPassed ? 0 : 1;
+	}
 
 	return 0;
 }
@@ -0,0 +1,206 @@
+#include "ReSTIR.h"
+
+// Unshadowed contribution of 'y' to a white diffuse surface at 'p' facing 'n'.
+static RGBColor lightContribution(const Scene& scene, const Point3f& p, const Vector3f& n, const LightSample& y)
+{
+	if (y.light < 0)
+		return RGBColor();
+
+	Vector3f toLight(p /*start*/, y.p /*end*/);
+	toLight.Normalize();
+	float cosSurface = dot(toLight, n);
+	if (cosSurface <= 0)
+		return RGBColor();
+
+	const LightEntry& entry = scene.GetLights()[y.light];
+	return entry.light->GetMaterialRecord().emissionColor * (cosSurface / entry.area);
+}
+
+float LightTargetPdf(const Scene& scene, const Point3f& p, const Vector3f& n, const LightSample& y)
+{
+	return luminance(lightContribution(scene, p, n, y));
+}
+
+Reservoir SampleLightCandidates(const Scene& scene, const Point3f& p, const Vector3f& n, int count, int stratum, RNG& rng)
+{
+	Reservoir r;
+	const LightTable& lights = scene.GetLights();
+
+	for (int i = 0; i < count; i++) {
+		float pmf;
+		LightSample x;
+		x.light = scene.SampleLight(p, n, rng.NextFloat(), &pmf);
+		if (x.light < 0)
+			return r;
+
+		const LightEntry& entry = lights[x.light];
+		float u1, u2;
+		if (stratum >= 0) {
+			lightGridSample(stratum, rng, &u1, &u2);
+		}
+		else {
+			u1 = rng.NextFloat();
+			u2 = rng.NextFloat();
+		}
+		float pdf;
+		if (!entry.light->SampleFromPoint(p, u1, u2, &x.p, &x.n, &pdf) || pdf <= 0) {
+			r.M += 1;
+			continue;
+		}
+
+		// The target is measured over the light's area, so convert the solid
+		// angle density of the candidate to area.
+		Vector3f toLight(p /*start*/, x.p /*end*/);
+		float dist2 = dot(toLight, toLight);
+		float areaPdf = pmf * pdf * fabs(dot(x.n, toLight)) / (dist2 * sqrt(dist2));
+		if (areaPdf <= 0) {
+			r.M += 1;
+			continue;
+		}
+		r.Update(x, LightTargetPdf(scene, p, n, x) / areaPdf, rng.NextFloat());
+	}
+
+	float pHat = LightTargetPdf(scene, p, n, r.y);
+	r.W = pHat > 0 ? r.wSum / (r.M * pHat) : 0.0f;
+	return r;
+}
+
+static bool fVisible(const Scene& scene, const Point3f& p, const LightSample& y)
+{
+	Vector3f toLight(p /*start*/, y.p /*end*/);
+	float dist = sqrt(dot(toLight, toLight));
+	Ray shadowRay(p, toLight);
+	return !scene.GetRoot().Hit(shadowRay, RAY_T0, dist * 0.999f, nullptr, nullptr, nullptr);
+}
+
+RGBColor ShadeReservoir(const Scene& scene, const Point3f& p, const Vector3f& n, const Reservoir& r)
+{
+	if (r.W <= 0 || !fVisible(scene, p, r.y))
+		return RGBColor();
+	return lightContribution(scene, p, n, r.y) * r.W;
+}
+
+ReSTIR::ReSTIR(const Scene& _scene, const Camera& _camera, int _width, int _height, bool _fTemporal) : scene(_scene), camera(_camera)
+{
+	width = _width;
+	height = _height;
+	frame = 0;
+	fTemporal = _fTemporal;
+	pixels[0].resize(width * height);
+	pixels[1].resize(width * height);
+}
+
+bool ReSTIR::fSimilar(const PixelState& pixel, const PixelState& other)
+{
+	return other.fDiffuse && dot(pixel.n, other.n) > RESTIR_NORMAL_THRESHOLD &&
+		fabs(other.depth - pixel.depth) < RESTIR_DEPTH_THRESHOLD * pixel.depth;
+}
+
+Reservoir ReSTIR::Combine(const PixelState& pixel, const PixelState **sources, const Reservoir **reservoirs, int count, RNG& rng) const
+{
+	Reservoir s;
+	for (int i = 0; i < count; i++) {
+		const Reservoir& r = *reservoirs[i];
+		float pHat = LightTargetPdf(scene, pixel.p, pixel.n, r.y);
+		s.Update(r.y, pHat * r.W * r.M, rng.NextFloat());
+		s.M += r.M - 1;
+	}
+
+	// Only count the candidates of the pixels that could have produced the
+	// sample kept, so that the result is not darkened near edges. A pixel
+	// that does not see the sample could not have kept it either, since
+	// occluded candidates are dropped. Whether 'pixel' itself sees it does not
+	// matter, as the sample is then shaded black anyway.
+	float Z = 0.0f;
+	for (int i = 0; i < count; i++) {
+		if (LightTargetPdf(scene, sources[i]->p, sources[i]->n, s.y) > 0 && (sources[i] == &pixel || fVisible(scene, sources[i]->p, s.y)))
+			Z += reservoirs[i]->M;
+	}
+
+	float pHat = LightTargetPdf(scene, pixel.p, pixel.n, s.y);
+	s.W = (pHat > 0 && Z > 0) ? s.wSum / (Z * pHat) : 0.0f;
+	return s;
+}
+
+void ReSTIR::SamplePixel(ThreadContext& ctx, int w, int h)
+{
+	PixelState& pixel = pixels[frame & 1][h * width + w];
+	pixel.ray = camera.GenerateRay(w, h, ctx.rng.NextFloat(), ctx.rng.NextFloat());
+	pixel.fDiffuse = false;
+	pixel.initial = Reservoir();
+
+	float t;
+	Surface *s = nullptr;
+	Vector3f normal;
+	if (!scene.GetRoot().Hit(pixel.ray, RAY_T0, RAY_T1, &t, &s, &normal) || s == nullptr || !s->fHasMaterial())
+		return;
+
+	const MaterialRecord& material = s->GetMaterialRecord();
+	if (material.reflType != Type::DIFF || material.fIsLight)
+		return;
+
+	normal.Normalize();
+	pixel.fDiffuse = true;
+	pixel.p = pixel.ray.origin + pixel.ray.direction * t;
+	pixel.n = dot(normal, pixel.ray.direction) < 0 ? normal : normal * -1;
+	pixel.depth = t;
+	pixel.albedo = material.materialColor * material.diffAmount;
+	ctx.segments++;
+
+	// Drop a candidate that turns out to be in shadow before anyone reuses it.
+	Reservoir candidates = SampleLightCandidates(scene, pixel.p, pixel.n, RIS_CANDIDATES, -1 /*stratum*/, ctx.rng);
+	if (candidates.W > 0 && !fVisible(scene, pixel.p, candidates.y))
+		candidates.W = 0.0f;
+
+	// The camera does not move, so the same pixel of the previous frame is
+	// where this point was seen. Its history is capped so that it keeps
+	// adapting.
+	const PixelState& previous = pixels[(frame + 1) & 1][h * width + w];
+	if (fTemporal && frame > 0 && fSimilar(pixel, previous)) {
+		Reservoir history = previous.reused;
+		history.M = std::min(history.M, RESTIR_HISTORY_LIMIT * candidates.M);
+
+		const PixelState *sources[2] = { &pixel, &previous };
+		const Reservoir *reservoirs[2] = { &candidates, &history };
+		pixel.initial = Combine(pixel, sources, reservoirs, 2, ctx.rng);
+	}
+	else {
+		pixel.initial = candidates;
+	}
+}
+
+RGBColor ReSTIR::ShadePixel(ThreadContext& ctx, int w, int h)
+{
+	PixelState& pixel = pixels[frame & 1][h * width + w];
+	if (!pixel.fDiffuse) {
+		pixel.reused = Reservoir();
+		return pixel.ray.traceForColor(scene, ctx, 0 /*depth*/, RGBColor(1.0f, 1.0f, 1.0f) /*throughput*/, false /*fHitDiffuse*/);
+	}
+
+	const PixelState *sources[RESTIR_SPATIAL_NEIGHBORS + 1];
+	const Reservoir *reservoirs[RESTIR_SPATIAL_NEIGHBORS + 1];
+	sources[0] = &pixel;
+	reservoirs[0] = &pixel.initial;
+	int count = 1;
+
+	for (int i = 0; i < RESTIR_SPATIAL_NEIGHBORS; i++) {
+		float radius = RESTIR_SPATIAL_RADIUS * sqrt(ctx.rng.NextFloat());
+		float phi = static_cast<float>(2 * M_PI) * ctx.rng.NextFloat();
+		int nw = w + static_cast<int>(radius * cos(phi));
+		int nh = h + static_cast<int>(radius * sin(phi));
+		if (nw < 0 || nh < 0 || nw >= width || nh >= height || (nw == w && nh == h))
+			continue;
+
+		const PixelState& neighbor = pixels[frame & 1][nh * width + nw];
+		if (!fSimilar(pixel, neighbor))
+			continue;
+
+		sources[count] = &neighbor;
+		reservoirs[count] = &neighbor.initial;
+		count++;
+	}
+
+	pixel.reused = Combine(pixel, sources, reservoirs, count, ctx.rng);
+	ctx.segments++;
+	return pixel.albedo * (ShadeReservoir(scene, pixel.p, pixel.n, pixel.reused) + scene.SampleEnvironment(pixel.p, pixel.n, ctx.rng.NextFloat(), ctx.rng.NextFloat()));
+}
@@ -0,0 +1,116 @@
+// Resampled direct lighting (Bitterli et al., "Spatiotemporal Reservoir
+// Resampling for Real-Time Ray Tracing with Dynamic Direct Lighting").
+// Many cheap light candidates are drawn for a shading point, and one is kept
+// by resampling them proportionally to their unshadowed contribution, so a
+// single shadow ray serves all of them. With per-pixel reservoirs, the
+// candidates kept by neighbouring pixels and by the previous frame are
+// resampled again.
+//
+// Light points are drawn in the same measure as the fast Lambertian shading:
+// a light picked from the scene, then a point uniformly on it, lit with the
+// cosine at the shading point only.
+#ifndef _RESTIR_H
+#define _RESTIR_H
+
+#include <vector>
+#include "Camera.h"
+#include "Scene.h"
+#include "ThreadContext.h"
+
+struct LightSample {
+	int light;			// index in the light table, -1 for none
+	Point3f p;
+	Vector3f n;
+};
+
+struct Reservoir {
+	LightSample y;		// the sample kept
+	float wSum;			// sum of the resampling weights seen
+	float M;			// number of candidates seen
+	float W;			// unbiased contribution weight of 'y'
+
+	Reservoir() {
+		y.light = -1;
+		wSum = 0.0f;
+		M = 0.0f;
+		W = 0.0f;
+	}
+
+	// Stream one candidate with resampling weight 'w' through the reservoir,
+	// 'u' in [0, 1) picks whether it replaces the sample kept.
+	void Update(const LightSample& x, float w, float u) {
+		wSum += w;
+		M += 1;
+		if (w > 0 && u * wSum < w)
+			y = x;
+	}
+};
+
+// Resampling target for the light point 'y' seen from the diffuse point 'p'
+// facing 'n': the luminance of its unshadowed contribution.
+float LightTargetPdf(const Scene& scene, const Point3f& p, const Vector3f& n, const LightSample& y);
+
+// Draw 'count' light candidates for 'p' and keep one of them. With a
+// 'stratum' in [0, LIGHT_SAMPLES), the points are drawn in that cell of the
+// light grid of every light, otherwise anywhere on it.
+Reservoir SampleLightCandidates(const Scene& scene, const Point3f& p, const Vector3f& n, int count, int stratum, RNG& rng);
+
+// Direct light reflected by a white diffuse surface at 'p' from the sample
+// kept by 'r', tracing one shadow ray.
+RGBColor ShadeReservoir(const Scene& scene, const Point3f& p, const Vector3f& n, const Reservoir& r);
+
+// Renders the camera hits of fast shading with reservoirs shared between
+// pixels. A frame is one sample per pixel: SamplePixel() must have run for
+// every pixel before ShadePixel() runs for any, and NextFrame() after.
+//
+// Temporal reuse makes each frame better on its own, but correlates the
+// frames, so averaging them converges more slowly. It is only worth it when
+// frames are looked at one by one, as in a sequence.
+class ReSTIR
+{
+public:
+	ReSTIR(const Scene& _scene, const Camera& _camera, int _width, int _height, bool _fTemporal);
+
+	// Trace the camera ray of pixel (w, h), draw its candidates and merge
+	// them with the pixel's reservoir of the previous frame.
+	void SamplePixel(ThreadContext& ctx, int w, int h);
+
+	// Merge the reservoirs of nearby pixels and return the pixel's color.
+	RGBColor ShadePixel(ThreadContext& ctx, int w, int h);
+
+	void NextFrame() { frame++; }
+
+private:
+	// What the camera ray of a pixel hit.
+	struct PixelState {
+		bool fDiffuse;		// hit a diffuse surface that is not a light
+		Point3f p;
+		Vector3f n;			// facing the camera
+		float depth;
+		RGBColor albedo;
+		Ray ray;			// traced as usual when the hit is not diffuse
+		Reservoir initial;	// candidates of this frame, merged with the previous frame
+		Reservoir reused;	// after merging the neighbours, what the next frame reuses
+
+		PixelState() : ray(Point3f(), Vector3f(0, 0, 1.f)) {
+			fDiffuse = false;
+			depth = 0.0f;
+		}
+	};
+
+	// Whether the reservoir of 'other' can be reused at 'pixel'.
+	static bool fSimilar(const PixelState& pixel, const PixelState& other);
+
+	// Resample the reservoirs of 'count' pixels for 'pixel'.
+	Reservoir Combine(const PixelState& pixel, const PixelState **sources, const Reservoir **reservoirs, int count, RNG& rng) const;
+
+	const Scene& scene;
+	const Camera& camera;
+	int width;
+	int height;
+	int frame;
+	bool fTemporal;
+	std::vector<PixelState> pixels[2];		// this frame and the previous one, by frame parity
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "Sampler.h"
+#include <algorithm>
+
+// Prime bases of the Halton dimensions. Later dimensions correlate badly
+// and are drawn from the random number generator instead.
+static const int HALTON_PRIMES[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+	59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+};
+static const int HALTON_DIMENSIONS = sizeof(HALTON_PRIMES) / sizeof(HALTON_PRIMES[0]);
+
+// Fractional parts of the generators of the rank-1 lattices, as fractions of
+// 2^32: the golden ratio for one dimension, and the powers of the inverse
+// plastic number for two (Roberts' R2 sequence).
+static const uint32_t KRONECKER_1D = 2654435769u;
+static const uint32_t KRONECKER_2D_X = 3242174889u;
+static const uint32_t KRONECKER_2D_Y = 2447445414u;
+
+// Largest float below 1.
+static const float ONE_MINUS_EPSILON = 0.99999994f;
+
+// Mix 'a' and 'b' into well scattered bits.
+static uint32_t hash(uint32_t a, uint32_t b)
+{
+	uint32_t x = a * 0x9e3779b9u ^ (b + 0x7f4a7c15u);
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static uint32_t reverseBits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Owen scrambling of the bits of a fraction, hashed from 'seed' (Burley,
+// "Practical Hash-based Owen Scrambling"): every bit is flipped or not
+// depending on the bits above it only. Works on the reversed bits 'x', where
+// the bits above are the lower ones, so that it can be done by multiplying.
+static uint32_t owenScrambleReversed(uint32_t x, uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return x;
+}
+
+// Reversed bits of the second dimension of the Sobol sequence at the index
+// whose reversed bits are 'reversedIndex'. The first dimension is the index
+// itself reversed. The reversed columns of its generator matrix are
+// v(0) = 1, v(i+1) = v(i) ^ 2 v(i), and the shuffled indices use all 32 bits,
+// so pick them without branches.
+static uint32_t sobol2Reversed(uint32_t reversedIndex)
+{
+	uint32_t result = 0;
+	uint32_t v = 1;
+	for (int i = 0; i < 32; i++, reversedIndex <<= 1, v ^= v << 1)
+		result ^= v & (0u - (reversedIndex >> 31));
+	return result;
+}
+
+static float toFloat(uint32_t x)
+{
+	return std::min(x * (1.0f / 4294967296.0f), ONE_MINUS_EPSILON);
+}
+
+Sampler *CreateSampler(SamplerType type, uint64_t seed, RNG& rng, const BlueNoiseMask *blueNoise)
+{
+	if (type == SamplerType::BLUE_NOISE)
+		return new BlueNoiseSampler(seed, *blueNoise);
+	if (type == SamplerType::HALTON)
+		return new HaltonSampler(seed, rng);
+	if (type == SamplerType::SOBOL)
+		return new SobolSampler(seed);
+	return new IndependentSampler(rng);
+}
+
+IndependentSampler::IndependentSampler(RNG& _rng) : rng(_rng)
+{
+}
+
+void IndependentSampler::StartPixelSample(int w, int h, int sampleIndex)
+{
+}
+
+float IndependentSampler::Get1D()
+{
+	return rng.NextFloat();
+}
+
+void IndependentSampler::Get2D(float *u1, float *u2)
+{
+	*u1 = rng.NextFloat();
+	*u2 = rng.NextFloat();
+}
+
+HaltonSampler::HaltonSampler(uint64_t _seed, RNG& _rng) : rng(_rng)
+{
+	seed = static_cast<uint32_t>(_seed ^ (_seed >> 32));
+	pixelSeed = 0;
+	index = 0;
+	dimension = 0;
+}
+
+void HaltonSampler::StartPixelSample(int w, int h, int sampleIndex)
+{
+	pixelSeed = hash(hash(seed, w), h);
+	index = sampleIndex;
+	dimension = 0;
+}
+
+float HaltonSampler::Get1D()
+{
+	if (dimension >= HALTON_DIMENSIONS)
+		return rng.NextFloat();
+
+	// Radical inverse of the index, with every digit shifted by the digit of
+	// a random number at the same position (random digit scrambling), which
+	// keeps the strata of the sequence but gives every pixel a different one.
+	uint32_t base = HALTON_PRIMES[dimension];
+	double shift = (hash(pixelSeed, dimension++) >> 8) * (1.0 / 16777216.0);
+	uint32_t a = index;
+	double invBase = 1.0 / base;
+	double invBaseM = 1.0;
+	double result = 0.0;
+	while (a > 0) {
+		uint32_t next = a / base;
+		uint32_t digit = a - next * base;
+		a = next;
+
+		shift *= base;
+		uint32_t shiftDigit = static_cast<uint32_t>(shift);
+		shift -= shiftDigit;
+		digit += shiftDigit;
+		if (digit >= base)
+			digit -= base;
+
+		invBaseM *= invBase;
+		result += digit * invBaseM;
+	}
+
+	// The digits past the last one of the index are zeros, so they are the
+	// rest of the random number.
+	result += shift * invBaseM;
+	return std::min(static_cast<float>(result), ONE_MINUS_EPSILON);
+}
+
+void HaltonSampler::Get2D(float *u1, float *u2)
+{
+	*u1 = Get1D();
+	*u2 = Get1D();
+}
+
+SobolSampler::SobolSampler(uint64_t _seed)
+{
+	seed = static_cast<uint32_t>(_seed ^ (_seed >> 32));
+	pixelSeed = 0;
+	index = 0;
+	dimension = 0;
+}
+
+void SobolSampler::StartPixelSample(int w, int h, int sampleIndex)
+{
+	pixelSeed = hash(hash(seed, w), h);
+	index = sampleIndex;
+	dimension = 0;
+}
+
+float SobolSampler::Get1D()
+{
+	// Shuffle the order of the samples by scrambling the index as well.
+	uint32_t dimensionSeed = hash(pixelSeed, dimension++);
+	uint32_t shuffledReversed = owenScrambleReversed(reverseBits(index), dimensionSeed);
+	return toFloat(reverseBits(owenScrambleReversed(reverseBits(shuffledReversed), dimensionSeed ^ 0xa511e9b3u)));
+}
+
+void SobolSampler::Get2D(float *u1, float *u2)
+{
+	// Every pair of dimensions is the first two dimensions of Sobol, which
+	// are a (0, 2)-sequence, in an order shuffled by the pair.
+	uint32_t dimensionSeed = hash(pixelSeed, dimension);
+	dimension += 2;
+	uint32_t shuffledReversed = owenScrambleReversed(reverseBits(index), dimensionSeed);
+	*u1 = toFloat(reverseBits(owenScrambleReversed(reverseBits(shuffledReversed), dimensionSeed ^ 0xa511e9b3u)));
+	*u2 = toFloat(reverseBits(owenScrambleReversed(sobol2Reversed(shuffledReversed), dimensionSeed ^ 0x63d83595u)));
+}
+
+BlueNoiseSampler::BlueNoiseSampler(uint64_t _seed, const BlueNoiseMask& _blueNoise) : blueNoise(_blueNoise)
+{
+	seed = static_cast<uint32_t>(_seed ^ (_seed >> 32));
+	pixelX = pixelY = 0;
+	index = 0;
+	dimension = 0;
+}
+
+void BlueNoiseSampler::StartPixelSample(int w, int h, int sampleIndex)
+{
+	pixelX = w;
+	pixelY = h;
+	index = sampleIndex;
+	dimension = 0;
+}
+
+void BlueNoiseSampler::NextOffsets(uint32_t *offset1, uint32_t *offset2)
+{
+	// Shift the mask by the R2 sequence over the dimensions, which keeps the
+	// shifts of the first dimensions far apart, from a start picked by the seed.
+	uint32_t start = hash(seed, 0);
+	uint32_t shiftX = (start + dimension * KRONECKER_2D_X) >> 16;
+	uint32_t shiftY = ((start << 16) + dimension * KRONECKER_2D_Y) >> 16;
+	dimension++;
+	blueNoise.Get(pixelX + static_cast<int>(shiftX), pixelY + static_cast<int>(shiftY), offset1, offset2);
+}
+
+float BlueNoiseSampler::Get1D()
+{
+	// Adding modulo 2^32 wraps the lattice around [0, 1).
+	uint32_t offset1, offset2;
+	NextOffsets(&offset1, &offset2);
+	return toFloat(offset1 + index * KRONECKER_1D);
+}
+
+void BlueNoiseSampler::Get2D(float *u1, float *u2)
+{
+	uint32_t offset1, offset2;
+	NextOffsets(&offset1, &offset2);
+	*u1 = toFloat(offset1 + index * KRONECKER_2D_X);
+	*u2 = toFloat(offset2 + index * KRONECKER_2D_Y);
+}
@@ -0,0 +1,115 @@
+// Sample generators.
+// A sampler hands out the numbers of one pixel sample at a time:
+// StartPixelSample() picks the pixel and the index of the sample, then every
+// Get1D() or Get2D() call takes the next dimension of that sample. The
+// quasi-Monte Carlo samplers spread the samples of a pixel evenly in every
+// dimension, and randomize the sequence of each pixel so that neighbouring
+// pixels do not share their error.
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <stdint.h>
+#include "BlueNoise.h"
+#include "RNG.h"
+
+enum class SamplerType : char {
+	INDEPENDENT,	// independent random numbers
+	HALTON,			// Halton sequence with random digit scrambling
+	SOBOL,			// Owen-scrambled Sobol, a shuffled 2D sequence per pair of dimensions
+	BLUE_NOISE,		// rank-1 lattice offset per pixel by a blue-noise mask, for previews
+};
+
+class Sampler
+{
+public:
+	virtual ~Sampler() {}
+
+	// Start sample 'sampleIndex' of pixel (w, h), from its first dimension.
+	virtual void StartPixelSample(int w, int h, int sampleIndex) = 0;
+
+	// Return the next dimension of the sample, in [0, 1).
+	virtual float Get1D() = 0;
+
+	// Return the next two dimensions of the sample, in [0, 1), which are
+	// well distributed together.
+	virtual void Get2D(float *u1, float *u2) = 0;
+};
+
+// Create a sampler of 'type' for one thread. The sequences are randomized
+// by 'seed', and 'rng' supplies any number they cannot. The blue-noise
+// sampler needs 'blueNoise', the others ignore it.
+Sampler *CreateSampler(SamplerType type, uint64_t seed, RNG& rng, const BlueNoiseMask *blueNoise);
+
+class IndependentSampler : public Sampler
+{
+public:
+	IndependentSampler(RNG& _rng);
+
+	virtual void StartPixelSample(int w, int h, int sampleIndex);
+	virtual float Get1D();
+	virtual void Get2D(float *u1, float *u2);
+
+private:
+	RNG& rng;
+};
+
+class HaltonSampler : public Sampler
+{
+public:
+	HaltonSampler(uint64_t _seed, RNG& _rng);
+
+	virtual void StartPixelSample(int w, int h, int sampleIndex);
+	virtual float Get1D();
+	virtual void Get2D(float *u1, float *u2);
+
+private:
+	uint32_t seed;
+	RNG& rng;			// past the last prime base
+	uint32_t pixelSeed;
+	uint32_t index;
+	int dimension;
+};
+
+class SobolSampler : public Sampler
+{
+public:
+	SobolSampler(uint64_t _seed);
+
+	virtual void StartPixelSample(int w, int h, int sampleIndex);
+	virtual float Get1D();
+	virtual void Get2D(float *u1, float *u2);
+
+private:
+	uint32_t seed;
+	uint32_t pixelSeed;
+	uint32_t index;
+	int dimension;
+};
+
+// Every dimension, or pair of them, is a rank-1 lattice over the samples of a
+// pixel (the golden ratio sequence, or R2 for pairs), shifted by the
+// thresholds of the pixel in a blue-noise mask. Each call reads the mask at a
+// shift of its own, so that dimensions do not repeat each other. The samples
+// of neighbouring pixels are as far apart as they can be, which makes the
+// error blue noise.
+class BlueNoiseSampler : public Sampler
+{
+public:
+	BlueNoiseSampler(uint64_t _seed, const BlueNoiseMask& _blueNoise);
+
+	virtual void StartPixelSample(int w, int h, int sampleIndex);
+	virtual float Get1D();
+	virtual void Get2D(float *u1, float *u2);
+
+private:
+	// Thresholds of the pixel for the next one or two dimensions.
+	void NextOffsets(uint32_t *offset1, uint32_t *offset2);
+
+	uint32_t seed;
+	const BlueNoiseMask& blueNoise;
+	int pixelX, pixelY;
+	uint32_t index;
+	int dimension;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "Scene.h"
+#include "Ray.h"
+
+Scene::Scene(const std::shared_ptr<Surface>& _pRoot, const std::shared_ptr<EnvironmentMap>& _pEnvironment)
+{
+	pRoot = _pRoot;
+	pEnvironment = _pEnvironment;
+
+	// The flat material table must be ready before anything asks the
+	// surfaces about their materials.
+	MaterialTable::Freeze();
+	lights.Build(*pRoot);
+
+	if (lights.Size() >= LIGHT_BVH_THRESHOLD)
+		lightBVH.Build(lights);
+}
+
+int Scene::SampleLight(const Point3f& p, const Vector3f& n, float u, float *pmf) const
+{
+	if (!lightBVH.empty())
+		return lightBVH.Sample(p, n, u, pmf);
+
+	if (lights.Size() == 0)
+		return -1;
+	return lights.Sample(u, pmf);
+}
+
+float Scene::LightPmf(const Point3f& p, const Vector3f& n, int index) const
+{
+	if (!lightBVH.empty())
+		return lightBVH.Pmf(p, n, index);
+	return lights.Pmf(index);
+}
+
+RGBColor Scene::SampleDirect(const Point3f& p, const Vector3f& n, float uLight, float u1, float u2) const
+{
+	float pmf;
+	int index = SampleLight(p, n, uLight, &pmf);
+	if (index < 0 || pmf <= 0)
+		return RGBColor();
+
+	const LightEntry& entry = lights[index];
+	Point3f lp;
+	Vector3f ln;
+	float pdf;
+	if (!entry.light->SampleFromPoint(p, u1, u2, &lp, &ln, &pdf) || pdf <= 0)
+		return RGBColor();
+
+	Vector3f toLight(p /*start*/, lp /*end*/);
+	float dist = sqrt(dot(toLight, toLight));
+	toLight.Normalize();
+	float cosSurface = dot(toLight, n);
+	float cosLight = -dot(ln, toLight);
+	if (cosSurface <= 0 || cosLight <= 0)
+		return RGBColor();
+
+	Ray shadowRay(p, toLight);
+	if (pRoot->Hit(shadowRay, RAY_T0, dist * 0.999f, nullptr, nullptr, nullptr))
+		return RGBColor();
+
+	// Lambertian BSDF over the solid angle density of the light point.
+	return entry.light->GetMaterialRecord().emissionColor * static_cast<float>(cosSurface / (M_PI * pdf * pmf));
+}
+
+RGBColor Scene::SampleEnvironment(const Point3f& p, const Vector3f& n, float u1, float u2) const
+{
+	if (!pEnvironment)
+		return RGBColor();
+
+	float pdf;
+	Vector3f dir = pEnvironment->Sample(u1, u2, &pdf);
+	float cosSurface = dot(dir, n);
+	if (pdf <= 0 || cosSurface <= 0)
+		return RGBColor();
+
+	Ray shadowRay(p, dir);
+	if (pRoot->Hit(shadowRay, RAY_T0, RAY_T1, nullptr, nullptr, nullptr))
+		return RGBColor();
+
+	return pEnvironment->Eval(dir) * static_cast<float>(cosSurface / (M_PI * pdf));
+}
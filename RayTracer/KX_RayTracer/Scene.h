@@ -0,0 +1,53 @@
+// A scene to render.
+// Holds the root surface together with the data precomputed from it before
+// rendering starts.
+#ifndef _SCENE_H
+#define _SCENE_H
+
+#include <memory>
+#include "EnvironmentMap.h"
+#include "LightBVH.h"
+#include "LightTable.h"
+#include "Surface.h"
+
+class Scene
+{
+public:
+	Scene(const std::shared_ptr<Surface>& _pRoot, const std::shared_ptr<EnvironmentMap>& _pEnvironment = nullptr);
+
+	const Surface& GetRoot() const { return *pRoot; }
+
+	const LightTable& GetLights() const { return lights; }
+
+	// nullptr if the scene has no environment map.
+	const EnvironmentMap *GetEnvironment() const { return pEnvironment.get(); }
+
+	// Radiance arriving from the normalized direction 'dir' when nothing is
+	// hit along it. Black without an environment map.
+	RGBColor GetBackground(const Vector3f& dir) const { return pEnvironment ? pEnvironment->Eval(dir) : RGBColor(); }
+
+	// Pick a light for the shading point 'p' with normal 'n' with 'u' in
+	// [0, 1), and store the probability of picking it in 'pmf'. Return the
+	// light's index in the light table, or -1 if there is none to pick.
+	int SampleLight(const Point3f& p, const Vector3f& n, float u, float *pmf) const;
+
+	// Return the probability that SampleLight() picks the light 'index'.
+	float LightPmf(const Point3f& p, const Vector3f& n, int index) const;
+
+	// Estimate the light reflected directly from the lights by a white
+	// diffuse surface at 'p' facing 'n', with one point on one light picked
+	// by 'uLight', 'u1' and 'u2' in [0, 1).
+	RGBColor SampleDirect(const Point3f& p, const Vector3f& n, float uLight, float u1, float u2) const;
+
+	// Same as SampleDirect() for the light of the environment map, with one
+	// direction picked by 'u1' and 'u2' in [0, 1).
+	RGBColor SampleEnvironment(const Point3f& p, const Vector3f& n, float u1, float u2) const;
+
+private:
+	std::shared_ptr<Surface> pRoot;
+	std::shared_ptr<EnvironmentMap> pEnvironment;
+	LightTable lights;
+	LightBVH lightBVH;	// only built for scenes with many lights
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "ScratchArena.h"
+
+ScratchArena::ScratchArena()
+{
+	Block block;
+	block.size = SCRATCH_BLOCK_SIZE;
+	block.data = new char[block.size];
+	blocks.push_back(block);
+
+	current = 0;
+	offset = 0;
+}
+
+ScratchArena::~ScratchArena()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+		delete[] blocks[i].data;
+}
+
+void* ScratchArena::Alloc(size_t size)
+{
+	size = (size + SCRATCH_ALIGNMENT - 1) & ~(SCRATCH_ALIGNMENT - 1);
+
+	while (offset + size > blocks[current].size) {
+		// Move on to the next block, and only grow the arena when the blocks
+		// kept from earlier paths are not enough.
+		current++;
+		offset = 0;
+		if (current == blocks.size()) {
+			Block block;
+			block.size = size > SCRATCH_BLOCK_SIZE ? size : SCRATCH_BLOCK_SIZE;
+			block.data = new char[block.size];
+			blocks.push_back(block);
+		}
+	}
+
+	void *p = blocks[current].data + offset;
+	offset += size;
+	return p;
+}
+
+ScratchArena::Mark ScratchArena::GetMark() const
+{
+	Mark mark;
+	mark.block = current;
+	mark.offset = offset;
+	return mark;
+}
+
+void ScratchArena::Rewind(const Mark& mark)
+{
+	current = mark.block;
+	offset = mark.offset;
+}
@@ -0,0 +1,62 @@
+// Per-thread bump allocator for temporary memory used while tracing.
+// Memory is taken from blocks that are kept for the lifetime of the arena,
+// so once the blocks are large enough for the deepest path, tracing does
+// not touch the heap at all.
+#ifndef _SCRATCHARENA_H
+#define _SCRATCHARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+const size_t SCRATCH_BLOCK_SIZE = 64 * 1024;
+const size_t SCRATCH_ALIGNMENT = 16;
+
+class ScratchArena
+{
+public:
+	// A position in the arena to rewind to.
+	struct Mark {
+		size_t block;
+		size_t offset;
+	};
+
+	ScratchArena();
+	~ScratchArena();
+
+	// Return uninitialized memory for 'size' bytes, aligned to SCRATCH_ALIGNMENT.
+	void* Alloc(size_t size);
+
+	// Return 'count' default constructed objects. Their destructors are
+	// never called, so only use it for trivially destructible types.
+	template <typename T>
+	T* Alloc(size_t count) {
+		T *p = static_cast<T*>(Alloc(count * sizeof(T)));
+		for (size_t i = 0; i < count; i++)
+			new (p + i) T();
+		return p;
+	}
+
+	Mark GetMark() const;
+
+	// Release everything allocated since 'mark' was taken.
+	void Rewind(const Mark& mark);
+
+	// Number of blocks allocated from the heap so far.
+	size_t GetBlockCount() const { return blocks.size(); }
+
+private:
+	ScratchArena(const ScratchArena&);
+	ScratchArena& operator=(const ScratchArena&);
+
+	struct Block {
+		char *data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t current;		// index of the block being allocated from
+	size_t offset;		// first free byte in the current block
+};
+
+#endif
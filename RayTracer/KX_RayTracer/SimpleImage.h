@@ -15,19 +15,19 @@ struct RGBColor {
 
   RGBColor() : r(0), g(0), b(0) { }
 
-  RGBColor operator+(const RGBColor& o) {
+  RGBColor operator+(const RGBColor& o) const {
     return RGBColor(r + o.r, g + o.g, b + o.b);
   }
 
-  RGBColor operator-(const RGBColor& o) {
+  RGBColor operator-(const RGBColor& o) const {
     return RGBColor(r - o.r, g - o.g, b - o.b);
   }
 
-  RGBColor operator*(const RGBColor& o) {
+  RGBColor operator*(const RGBColor& o) const {
     return RGBColor(r * o.r, g * o.g, b * o.b);
   }
 
-  RGBColor operator*(float s) {
+  RGBColor operator*(float s) const {
     return RGBColor(r * s, g * s, b * s);
   }
 
@@ -39,7 +39,7 @@ struct RGBColor {
     return (r + g + b) > (o.r + o.g + o.b);
   }
 
-  RGBColor Trunc()
+  RGBColor Trunc() const
   {
     RGBColor result(r, g, b);
     result.r = result.r < 0 ? 0 : result.r > 1 ? 1 : result.r;
@@ -58,9 +58,48 @@ void Sphere::GatherLightSources(std::vector<const Surface*>& lights) const
 		lights.push_back(this);
 }
 
-Point3f Sphere::GetLightPointInGrid(int gridNum) const
+bool Sphere::SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const
 {
-	return center;
+	float z = 1 - 2 * u1;
+	float r = sqrt(std::max(0.0f, 1 - z * z));
+	float phi = static_cast<float>(2 * M_PI) * u2;
+
+	Vector3f dir(r * cos(phi), r * sin(phi), z);
+	*p = center + dir * radius;
+	*n = dir;
+	return true;
+}
+
+bool Sphere::SampleFromPoint(const Point3f& ref, float u1, float u2, Point3f *p, Vector3f *n, float *pdf) const
+{
+	Vector3f toCenter(ref /*start*/, center /*end*/);
+	float dist2 = dot(toCenter, toCenter);
+	if (dist2 <= radius * radius)
+		return Surface::SampleFromPoint(ref, u1, u2, p, n, pdf);
+
+	// 1 - cos(thetaMax) written so that it does not cancel for far spheres.
+	float sin2ThetaMax = radius * radius / dist2;
+	float cosThetaMax = sqrt(std::max(0.0f, 1 - sin2ThetaMax));
+	float oneMinusCosThetaMax = sin2ThetaMax / (1 + cosThetaMax);
+
+	float cosTheta = 1 - u1 * oneMinusCosThetaMax;
+	float sin2Theta = std::max(0.0f, 1 - cosTheta * cosTheta);
+	float sinTheta = sqrt(sin2Theta);
+	float phi = static_cast<float>(2 * M_PI) * u2;
+
+	float dist = sqrt(dist2);
+	Vector3f w = toCenter * (1 / dist);
+	Vector3f u, v;
+	orthonormalBasis(w, &u, &v);
+	Vector3f dir = u * (cos(phi) * sinTheta) + v * (sin(phi) * sinTheta) + w * cosTheta;
+
+	// Nearest intersection of the sampled direction with the sphere.
+	float t = dist * cosTheta - sqrt(std::max(0.0f, radius * radius - dist2 * sin2Theta));
+	*p = ref + dir * t;
+	*n = Vector3f(center /*start*/, *p /*end*/);
+	n->Normalize();
+	*pdf = static_cast<float>(1 / (2 * M_PI)) / oneMinusCosThetaMax;
+	return true;
 }
 
 Vector3f Sphere::GetNormal(const Point3f& p) const
@@ -70,6 +109,16 @@ Vector3f Sphere::GetNormal(const Point3f& p) const
 	return normal;
 }
 
+float Sphere::GetArea() const
+{
+	return static_cast<float>(4 * M_PI) * radius * radius;
+}
+
+BBox Sphere::GetBounds() const
+{
+	return BBox(center - Point3f(radius, radius, radius)).Union(center + Point3f(radius, radius, radius));
+}
+
 Point3f Sphere::GetCenter() const
 {
 	return center;
@@ -15,10 +15,18 @@ public:
 
 	virtual void GatherLightSources(std::vector<const Surface*>& lights) const;
 
-	virtual Point3f GetLightPointInGrid(int gridNum) const;
+	virtual bool SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const;
+
+	// Pick a point uniformly inside the cone of directions subtended by the
+	// sphere, so only the side facing 'ref' is sampled.
+	virtual bool SampleFromPoint(const Point3f& ref, float u1, float u2, Point3f *p, Vector3f *n, float *pdf) const;
 
 	virtual Vector3f GetNormal(const Point3f& p) const;
 
+	virtual float GetArea() const;
+
+	virtual BBox GetBounds() const;
+
 	Point3f GetCenter() const;
 	void SetCenter(const Point3f& _c);
 
@@ -0,0 +1,27 @@
+#include "SplatBuffer.h"
+#include "Utility.h"
+
+SplatBuffer::SplatBuffer(int _width, int _height)
+{
+	width = _width;
+	height = _height;
+	data.reset(new std::atomic<long long>[width * height * 3]);
+	for (int i = 0; i < width * height * 3; i++)
+		data[i].store(0, std::memory_order_relaxed);
+}
+
+void SplatBuffer::Add(int w, int h, const RGBColor& c)
+{
+	int index = (h * width + w) * 3;
+	atomicAdd(data[index + 0], c.r);
+	atomicAdd(data[index + 1], c.g);
+	atomicAdd(data[index + 2], c.b);
+}
+
+RGBColor SplatBuffer::Get(int w, int h) const
+{
+	int index = (h * width + w) * 3;
+	return RGBColor(fromFixedPoint(data[index + 0].load(std::memory_order_relaxed)),
+		fromFixedPoint(data[index + 1].load(std::memory_order_relaxed)),
+		fromFixedPoint(data[index + 2].load(std::memory_order_relaxed)));
+}
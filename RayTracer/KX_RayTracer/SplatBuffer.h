@@ -0,0 +1,28 @@
+// Image buffer that any thread can add colors to at any pixel.
+// Used for contributions that do not belong to the pixel being rendered,
+// such as light tracing in the bidirectional path tracer.
+#ifndef _SPLATBUFFER_H
+#define _SPLATBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include "SimpleImage.h"
+
+class SplatBuffer
+{
+public:
+	SplatBuffer(int _width, int _height);
+
+	// Add 'c' to pixel (w, h). Safe to call from several threads at once,
+	// and the sums do not depend on the order of the calls.
+	void Add(int w, int h, const RGBColor& c);
+
+	RGBColor Get(int w, int h) const;
+
+private:
+	int width;
+	int height;
+	std::unique_ptr<std::atomic<long long>[]> data;	// r, g, b for each pixel, in fixed point
+};
+
+#endif
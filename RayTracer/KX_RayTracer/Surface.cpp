@@ -1,16 +1,42 @@
 #include "Surface.h"
 
+Surface::Surface()
+{
+	materialIndex = NO_MATERIAL;
+}
+
 void Surface::SetMaterial(const std::shared_ptr<Material>& _pMaterial)
 {
-	pMaterial = _pMaterial;
+	materialIndex = MaterialTable::Intern(_pMaterial);
 }
 
 std::shared_ptr<Material> Surface::GetMaterial() const
 {
-	return pMaterial;
+	return fHasMaterial() ? MaterialTable::GetShared(materialIndex) : nullptr;
+}
+
+DirectionCone Surface::GetNormalCone() const
+{
+	return DirectionCone();
 }
 
-bool Surface::fIsLight() const
+bool Surface::SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const
 {
-	return !(GetMaterial()->emissionColor == RGBColor());
+	return false;
+}
+
+bool Surface::SampleFromPoint(const Point3f& ref, float u1, float u2, Point3f *p, Vector3f *n, float *pdf) const
+{
+	if (!SamplePoint(u1, u2, p, n))
+		return false;
+
+	// Convert the area density 1 / area to solid angle.
+	Vector3f toPoint(ref /*start*/, *p /*end*/);
+	float dist2 = dot(toPoint, toPoint);
+	float cosPoint = fabs(dot(*n, toPoint)) / sqrt(dist2);
+	if (dist2 <= 0 || cosPoint <= 0)
+		return false;
+
+	*pdf = dist2 / (cosPoint * GetArea());
+	return true;
 }
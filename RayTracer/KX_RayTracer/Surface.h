@@ -7,12 +7,15 @@
 #include <vector>
 #include "Utility.h"
 #include "Material.h"
+#include "MaterialTable.h"
 
 struct Ray;
 
 class Surface
 {
 public:
+	Surface();
+
 	// Return true if 'ray' hits this surface between t0 and t1, and store the
 	// hit point in 't' if 't' is not NULL, and store the surface that was hit
 	// in 's' if 's' is not NULL, and store the normal in 'normal' if it is not
@@ -21,20 +24,39 @@ public:
 
 	virtual Vector3f GetNormal(const Point3f& p) const = 0;
 
+	// Return the surface area.
+	virtual float GetArea() const = 0;
+
+	virtual BBox GetBounds() const = 0;
+
+	// Return a cone containing all the normals of this surface.
+	virtual DirectionCone GetNormalCone() const;
+
 	// Put all the light sources into 'lights'.
 	virtual void GatherLightSources(std::vector<const Surface*>& lights) const = 0;
 
-	// Return a random position inside the light grid 'gridNum'.
-	// Only used if this surface is a light source.
-	virtual Point3f GetLightPointInGrid(int gridNum) const = 0;
+	// Pick a point uniformly over the surface area with u1, u2 in [0, 1), and
+	// store it in 'p' and the normal there in 'n'. Return false if the
+	// surface does not support it.
+	virtual bool SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const;
+
+	// Pick a point on the surface as seen from 'ref' with u1, u2 in [0, 1),
+	// and store the density of the direction towards it per unit solid angle
+	// in 'pdf'. By default the point is picked uniformly over the area.
+	virtual bool SampleFromPoint(const Point3f& ref, float u1, float u2, Point3f *p, Vector3f *n, float *pdf) const;
 
 	virtual void SetMaterial(const std::shared_ptr<Material>& _pMaterial);
 	std::shared_ptr<Material> GetMaterial() const;
 
-	bool fIsLight() const;
+	bool fHasMaterial() const { return materialIndex != NO_MATERIAL; }
+
+	// Only valid once MaterialTable::Freeze() has been called.
+	const MaterialRecord& GetMaterialRecord() const { return MaterialTable::Get(materialIndex); }
+
+	bool fIsLight() const { return fHasMaterial() && GetMaterialRecord().fIsLight; }
 
 private:
-	std::shared_ptr<Material> pMaterial;
+	uint16_t materialIndex;
 };
 
 #endif
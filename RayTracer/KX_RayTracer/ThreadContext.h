@@ -0,0 +1,36 @@
+// Per-thread rendering state.
+// Each thread owns one and hands it down the tracing calls, so threads do
+// not share anything while tracing, random numbers included, except for the
+// irradiance cache and the path guide, which are built to be used from all
+// threads at once.
+#ifndef _THREADCONTEXT_H
+#define _THREADCONTEXT_H
+
+#include "RNG.h"
+#include "ScratchArena.h"
+
+class IrradianceCache;
+class PathGuide;
+class Sampler;
+
+struct ThreadContext {
+	unsigned long long paths;		// camera paths traced
+	unsigned long long segments;	// ray segments traced along those paths
+
+	ScratchArena arena;				// temporary memory for the tracing calls
+	RNG rng;						// random numbers of the current pixel sample
+	Sampler *sampler;				// numbers of the current pixel sample, nullptr outside of the camera paths
+
+	IrradianceCache *irradianceCache;	// shared by all threads, nullptr when not used
+	PathGuide *pathGuide;				// shared by all threads, nullptr when not used
+
+	ThreadContext() {
+		paths = 0;
+		segments = 0;
+		sampler = nullptr;
+		irradianceCache = nullptr;
+		pathGuide = nullptr;
+	}
+};
+
+#endif
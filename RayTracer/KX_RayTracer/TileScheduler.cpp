@@ -0,0 +1,125 @@
+#include "TileScheduler.h"
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// A range of tiles [begin, end) packed in one word, begin in the high half.
+static unsigned long long packRange(unsigned int begin, unsigned int end)
+{
+	return (static_cast<unsigned long long>(begin) << 32) | end;
+}
+
+static unsigned int rangeBegin(unsigned long long range)
+{
+	return static_cast<unsigned int>(range >> 32);
+}
+
+static unsigned int rangeEnd(unsigned long long range)
+{
+	return static_cast<unsigned int>(range);
+}
+
+// Position of cell (x, y) along the Hilbert curve through a 'size' x 'size'
+// grid, 'size' a power of two.
+static unsigned int hilbertIndex(unsigned int size, unsigned int x, unsigned int y)
+{
+	unsigned int d = 0;
+	for (unsigned int s = size / 2; s > 0; s /= 2) {
+		unsigned int rx = (x & s) ? 1 : 0;
+		unsigned int ry = (y & s) ? 1 : 0;
+		d += s * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant so that the curve inside it starts where the
+		// previous quadrant's ended.
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - (x & (s - 1));
+				y = s - 1 - (y & (s - 1));
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int _workers) : workers(std::max(_workers, 1)),
+	storage(new char[(std::max(_workers, 1) + 1) * sizeof(Queue)])
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(storage.get());
+	queues = reinterpret_cast<Queue*>((address + CACHE_LINE_SIZE - 1) & ~static_cast<uintptr_t>(CACHE_LINE_SIZE - 1));
+	for (int i = 0; i < workers; i++)
+		new (queues + i) Queue();
+
+	// Order the tiles along a Hilbert curve through the smallest square grid
+	// of a power of two tiles that covers the image. Tiles close along the
+	// curve are close in the image, and so hit the same parts of the scene,
+	// and so does every run of tiles a thread starts with or steals.
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	unsigned int size = 1;
+	while (size < static_cast<unsigned int>(std::max(tilesX, tilesY)))
+		size *= 2;
+
+	std::vector<std::pair<unsigned int, Tile> > order;
+	for (int ty = 0; ty < tilesY; ty++) {
+		for (int tx = 0; tx < tilesX; tx++) {
+			int x = tx * tileSize, y = ty * tileSize;
+			Tile tile = { x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) };
+			order.push_back(std::make_pair(hilbertIndex(size, tx, ty), tile));
+		}
+	}
+	std::sort(order.begin(), order.end(), [](const std::pair<unsigned int, Tile>& a, const std::pair<unsigned int, Tile>& b) {
+		return a.first < b.first;
+	});
+	for (size_t i = 0; i < order.size(); i++)
+		tiles.push_back(order[i].second);
+
+	unsigned int count = static_cast<unsigned int>(tiles.size());
+	for (int i = 0; i < workers; i++)
+		queues[i].range.store(packRange(count * i / workers, count * (i + 1) / workers));
+}
+
+bool TileScheduler::Next(int worker, Tile *tile)
+{
+	// A range only ever holds tiles no thread has taken yet, so swapping in a
+	// smaller one claims the tiles left out of it, even if the range has been
+	// emptied and filled again in between.
+	std::atomic<unsigned long long>& range = queues[worker].range;
+	for (;;) {
+		unsigned long long r = range.load();
+		while (rangeBegin(r) < rangeEnd(r)) {
+			if (range.compare_exchange_weak(r, packRange(rangeBegin(r) + 1, rangeEnd(r)))) {
+				*tile = tiles[rangeBegin(r)];
+				return true;
+			}
+		}
+		if (!Steal(worker))
+			return false;
+	}
+}
+
+bool TileScheduler::Steal(int worker)
+{
+	for (;;) {
+		int victim = -1;
+		unsigned long long r = 0;
+		for (int i = 0; i < workers; i++) {
+			unsigned long long candidate = queues[i].range.load();
+			unsigned int left = rangeEnd(candidate) - rangeBegin(candidate);
+			if (i != worker && rangeBegin(candidate) < rangeEnd(candidate) && (victim < 0 || left > rangeEnd(r) - rangeBegin(r))) {
+				victim = i;
+				r = candidate;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		// Take the tiles at the end, the ones the victim would get to last.
+		unsigned int split = rangeEnd(r) - (rangeEnd(r) - rangeBegin(r) + 1) / 2;
+		if (queues[victim].range.compare_exchange_strong(r, packRange(rangeBegin(r), split))) {
+			queues[worker].range.store(packRange(split, rangeEnd(r)));
+			return true;
+		}
+	}
+}
@@ -0,0 +1,55 @@
+// Hands out the square tiles of an image to the rendering threads.
+// Every thread starts with a contiguous run of tiles of its own, and once it
+// runs out it steals half of the tiles left to the thread with the most, so
+// that all threads stay busy until the last tiles of the image. Taking and
+// stealing tiles never blocks.
+#ifndef _TILESCHEDULER_H
+#define _TILESCHEDULER_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Utility.h"
+
+// Pixels [x0, x1) x [y0, y1) of the image.
+struct Tile {
+	int x0, y0;
+	int x1, y1;
+};
+
+class TileScheduler
+{
+public:
+	// Split a 'width' x 'height' image into tiles of 'tileSize' pixels a side
+	// for 'workers' threads.
+	TileScheduler(int width, int height, int tileSize, int workers);
+
+	int GetTileCount() const { return static_cast<int>(tiles.size()); }
+
+	// Take the next tile for thread 'worker', in [0, workers). Return false
+	// once every tile has been taken.
+	bool Next(int worker, Tile *tile);
+
+private:
+	// The tiles a thread has left, as a range of indices into 'tiles' packed
+	// in one word so that it can be changed by compare and swap. Padded to
+	// keep each thread's range on a cache line of its own.
+	struct Queue {
+		std::atomic<unsigned long long> range;
+		char padding[CACHE_LINE_SIZE - sizeof(std::atomic<unsigned long long>)];
+	};
+
+	// Move half of the tiles of the thread with the most left to 'worker''s
+	// empty queue. Return false when no thread has any left.
+	bool Steal(int worker);
+
+	std::vector<Tile> tiles;
+	int workers;
+
+	// The queues, placed in 'storage' at the first cache line boundary, as
+	// new only aligns to 8 or 16 bytes. 'storage' has a line to spare.
+	std::unique_ptr<char[]> storage;
+	Queue *queues;
+};
+
+#endif
@@ -100,15 +100,17 @@ void Triangle::GatherLightSources(std::vector<const Surface*>& lights) const
 		lights.push_back(this);
 }
 
-Point3f Triangle::GetLightPointInGrid(int gridNum) const
+bool Triangle::SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const
 {
-	Vector3f u(vertex2 /*start*/, vertex1 /*end*/);
-	Vector3f v(vertex2 /*start*/, vertex3 /*end*/);
-
-	float du = _rand();
-	float dv = _rand();
-
-	return vertex2 + u * du + v * dv;
+	// Warp the unit square onto the triangle with uniform density.
+	float su = sqrt(u1);
+	float b1 = 1 - su;
+	float b2 = u2 * su;
+
+	*p = vertex1 * b1 + vertex2 * b2 + vertex3 * (1 - b1 - b2);
+	*n = GetNormal(*p);
+	n->Normalize();
+	return true;
 }
 
 Vector3f Triangle::GetNormal(const Point3f& /*p*/) const
@@ -118,3 +120,19 @@ Vector3f Triangle::GetNormal(const Point3f& /*p*/) const
 
 	return cross(u, v);
 }
+
+float Triangle::GetArea() const
+{
+	Vector3f n = GetNormal(Point3f() /*not used*/);
+	return 0.5f * sqrt(dot(n, n));
+}
+
+BBox Triangle::GetBounds() const
+{
+	return BBox(vertex1).Union(vertex2).Union(vertex3);
+}
+
+DirectionCone Triangle::GetNormalCone() const
+{
+	return DirectionCone(GetNormal(Point3f() /*not used*/), 1.0f);
+}
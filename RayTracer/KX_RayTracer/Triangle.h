@@ -14,10 +14,16 @@ public:
  
 	virtual void GatherLightSources(std::vector<const Surface*>& lights) const;
 
-	virtual Point3f GetLightPointInGrid(int gridNum) const;
+	virtual bool SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const;
 
 	virtual Vector3f GetNormal(const Point3f& p) const;
 
+	virtual float GetArea() const;
+
+	virtual BBox GetBounds() const;
+
+	virtual DirectionCone GetNormalCone() const;
+
 	Point3f GetVertex1() const { return vertex1; }
 	Point3f GetVertex2() const { return vertex2; }
 	Point3f GetVertex3() const { return vertex3; }
@@ -2,20 +2,40 @@
 #include <limits>
 #include <Windows.h>
 #include "Group.h"
+#include "RNG.h"
 #include "Triangle.h"
 
-bool fUseFastShading = false;
-
-// Return a random float between 0.0 and 1.0.
-float _rand() {
-	return static_cast<float>(rand()) / RAND_MAX;
-}
+ShadingMode shadingMode = ShadingMode::SLOW;
+int minPathDepth = 2;
+int maxPathDepth = 5;
+bool fStochasticFresnel = false;
 
 float dot(Vector3f v1, Vector3f v2)
 {
 	return (v1.x * v2.x + v1.y * v2.y + v1.z * v2.z);
 }
 
+// Perceived brightness of a color, using the Rec. 709 weights.
+float luminance(const RGBColor& c)
+{
+	return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+long long toFixedPoint(float v)
+{
+	return static_cast<long long>(floor(v * FIXED_POINT_SCALE + 0.5));
+}
+
+float fromFixedPoint(long long v)
+{
+	return static_cast<float>(v / FIXED_POINT_SCALE);
+}
+
+void atomicAdd(std::atomic<long long>& target, float v)
+{
+	target.fetch_add(toFixedPoint(v), std::memory_order_relaxed);
+}
+
 Vector3f cross(Vector3f v1, Vector3f v2) {
 	Vector3f prod;
 	prod.x = v1.y * v2.z - v1.z * v2.y;
@@ -24,6 +44,82 @@ Vector3f cross(Vector3f v1, Vector3f v2) {
 	return prod;
 }
 
+// Range reduction by multiples of pi / 2 split in three parts, each of
+// which times the quadrant is exact (Cody and Waite), then the minimax
+// polynomials of sin and cos on [-pi / 4, pi / 4] from Cephes. Written
+// without branches so that the loop over many angles is vectorized.
+static inline void polynomialSinCos(float x, float *s, float *c)
+{
+	const float TWO_OVER_PI = 0.636619772f;
+	const float PI_OVER_2_A = 1.5703125f;
+	const float PI_OVER_2_B = 4.83751297e-4f;
+	const float PI_OVER_2_C = 7.54979013e-8f;
+
+	// Round to the nearest quadrant by truncating, floor is a library call.
+	float scaled = x * TWO_OVER_PI;
+	int quadrant = static_cast<int>(scaled + (scaled < 0 ? -0.5f : 0.5f));
+	float q = static_cast<float>(quadrant);
+	float r = ((x - q * PI_OVER_2_A) - q * PI_OVER_2_B) - q * PI_OVER_2_C;
+	float r2 = r * r;
+
+	float sinR = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+	float cosR = 1 - 0.5f * r2 + r2 * r2 * (4.166664568e-2f + r2 * (-1.388731625e-3f + r2 * 2.443315712e-5f));
+
+	// sin and cos of r + quadrant * pi / 2.
+	float sinX = (quadrant & 1) ? cosR : sinR;
+	float cosX = (quadrant & 1) ? sinR : cosR;
+	*s = (quadrant & 2) ? -sinX : sinX;
+	*c = ((quadrant + 1) & 2) ? -cosX : cosX;
+}
+
+void fastSinCos(float x, float *s, float *c)
+{
+	polynomialSinCos(x, s, c);
+}
+
+void fastSinCos(const float *x, float *s, float *c, int count)
+{
+	for (int i = 0; i < count; i++)
+		polynomialSinCos(x[i], &s[i], &c[i]);
+}
+
+void orthonormalBasis(const Vector3f& w, Vector3f *u, Vector3f *v) {
+	*u = cross((fabs(w.x) > 0.1) ? Vector3f(0, 1.f, 0) : Vector3f(1.f, 0, 0), w);
+	u->Normalize();
+	*v = cross(w, *u);
+}
+
+Vector3f sampleCosineHemisphere(const Vector3f& w, float u1, float u2) {
+	Vector3f u, v;
+	orthonormalBasis(w, &u, &v);
+
+	float sinPhi, cosPhi;
+	fastSinCos(static_cast<float>(2 * M_PI) * u1, &sinPhi, &cosPhi);
+	float r = sqrt(u2);
+	return u * (cosPhi * r) + v * (sinPhi * r) + w * sqrt(std::max(0.0f, 1 - u2));
+}
+
+void lightGridSample(int gridNum, RNG& rng, float *u1, float *u2) {
+	*u1 = (gridNum % LIGHT_GRID + rng.NextFloat()) / LIGHT_GRID;
+	*u2 = (gridNum / LIGHT_GRID % LIGHT_GRID + rng.NextFloat()) / LIGHT_GRID;
+}
+
+float refractDielectric(const Vector3f& dir, const Vector3f& normal, float ni, float nt, Vector3f *refrDir) {
+	float nnt = ni / nt;                             // sin(t) / sin(i)
+	float cosi = fabs(dot(dir, normal));             // cos(i)
+	float cos2t = 1 - nnt * nnt * (1 - cosi * cosi); // cos(t)^2
+
+	if (cos2t < 0) // Total internal Reflection
+		return 1.0f;
+
+	float cost = sqrt(cos2t);
+	*refrDir = dir * nnt + normal * (nnt * cosi - cost);
+
+	float Rs = pow((nnt * cosi - cost) / (nnt * cosi + cost), 2);
+	float Rp = pow((nnt * cost - cosi) / (nnt * cost + cosi), 2);
+	return (Rs + Rp) / 2;
+}
+
 double get_wall_time() {
 	LARGE_INTEGER time, freq;
 	if (!QueryPerformanceFrequency(&freq)) {
@@ -55,6 +151,43 @@ Point3f Point3f::operator+(const Vector3f& add) const {
 	return Point3f(x + add.x, y + add.y, z + add.z);
 }
 
+Vector3f BBox::Diagonal() const {
+	return empty() ? Vector3f() : Vector3f(pMin /*start*/, pMax /*end*/);
+}
+
+int BBox::MaxExtent() const {
+	Vector3f d = Diagonal();
+	if (d.x > d.y && d.x > d.z)
+		return 0;
+	return (d.y > d.z) ? 1 : 2;
+}
+
+DirectionCone DirectionCone::Union(const DirectionCone& a, const DirectionCone& b) {
+	float theta_a = acos(std::max(-1.0f, std::min(1.0f, a.cosTheta)));
+	float theta_b = acos(std::max(-1.0f, std::min(1.0f, b.cosTheta)));
+	float theta_d = acos(std::max(-1.0f, std::min(1.0f, dot(a.axis, b.axis))));
+
+	// One of the cones may already contain the other.
+	if (std::min(theta_d + theta_b, static_cast<float>(M_PI)) <= theta_a)
+		return a;
+	if (std::min(theta_d + theta_a, static_cast<float>(M_PI)) <= theta_b)
+		return b;
+
+	float theta_o = (theta_a + theta_d + theta_b) / 2;
+	if (theta_o >= M_PI)
+		return DirectionCone();
+
+	// Rotate a's axis towards b's by theta_r (Rodrigues' rotation formula).
+	float theta_r = theta_o - theta_a;
+	Vector3f k = cross(a.axis, b.axis);
+	if (dot(k, k) == 0)
+		return DirectionCone();
+	k.Normalize();
+
+	Vector3f axis = a.axis * cos(theta_r) + cross(k, a.axis) * sin(theta_r) + k * (dot(k, a.axis) * (1 - cos(theta_r)));
+	return DirectionCone(axis, cos(theta_o));
+}
+
 const int MESH_LINE_MAX = 255;   // max number of chars in one line in mesh file
 
 int GetVertexIndexFromString(const std::string& str) {
@@ -4,25 +4,70 @@
 #define _UTILITY_H
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
 #include <memory>
 #include "SimpleImage.h"
 
+class RNG;
 class Surface;
 struct Vector3f;
 
 const float RAY_T0 = 0.0001f;
 const float RAY_T1 = 1000.0f;
 
-const int LIGHT_SAMPLES      = 16;  // Each light source is a 4x4 grids.
+const int LIGHT_GRID         = 3;   // Each light source is a 3x3 grids.
+const int LIGHT_SAMPLES      = LIGHT_GRID * LIGHT_GRID;
 const int ECLIPTIC_SAMPLES   = 8;   // Diffuse Reflection samples at ecliptic.
 const int HEMISPHERE_SAMPLES = 4;   // Diffuse Reflection samples in the upper hemisphere.
 
-const float REFLECTION_FACTOR = 0.99f;
-const float DIFFUSE_FACTOR = 0.3f;
-const float REFRACTION_FACTOR = 0.99f;
+const int LIGHT_BVH_THRESHOLD = 16; // Scenes with at least this many lights sample them with a light BVH.
 
-extern bool fUseFastShading;
+const int IRRADIANCE_THETA_SAMPLES = 6;     // Irradiance cache record samples along the elevation.
+const int IRRADIANCE_PHI_SAMPLES   = 18;    // Irradiance cache record samples around the normal.
+const float IRRADIANCE_CACHE_ERROR = 0.3f;  // Ward's 'a', how far records are reused.
+const int IRRADIANCE_POOL_BLOCK = 4096;     // Irradiance cache records or nodes taken from the heap at once.
+const int IRRADIANCE_POOL_BLOCKS = 1024;    // Most of those blocks, after which the cache stops growing.
+
+const float GUIDING_FRACTION = 0.5f;        // Share of guided diffuse bounces, the rest are cosine-weighted.
+const float ENVIRONMENT_FRACTION = 0.5f;    // Share of diffuse bounces towards the environment map's bright texels.
+
+const double FIXED_POINT_SCALE = 1048576.0; // Steps per unit of shared sums, 2^20: 1e-6 apart, up to 8e12.
+
+const int ADAPTIVE_MIN_SAMPLES = 16;        // Samples of every pixel before adaptive sampling looks at their error.
+
+const int TILE_SIZE = 16;                   // Side of the square tiles the threads render, in pixels.
+const size_t CACHE_LINE_SIZE = 64;          // Bytes, for keeping data threads write on lines of its own.
+const double PROGRESS_INTERVAL = 1.0;       // Seconds between progress reports.
+
+const int BLUE_NOISE_SIZE = 64;             // Side of the blue-noise mask tiling the image, in pixels.
+const int PREVIEW_EFFORT = 8;               // Efforts up to this use the blue-noise sampler by default.
+
+const int RIS_CANDIDATES = 8;               // Light candidates resampled for each shadow ray in fast shading.
+const int RESTIR_SPATIAL_NEIGHBORS = 5;     // Pixels whose reservoirs are reused by each pixel.
+const float RESTIR_SPATIAL_RADIUS = 10.0f;  // In pixels.
+const float RESTIR_NORMAL_THRESHOLD = 0.9f; // Cosine between normals above which a reservoir is reused.
+const float RESTIR_DEPTH_THRESHOLD = 0.1f;  // Relative difference of depth below which a reservoir is reused.
+const float RESTIR_HISTORY_LIMIT = 20.0f;   // Cap of the previous frame's candidates, relative to the new ones.
+
+// How the diffuse surfaces are shaded.
+enum class ShadingMode : char {
+	SLOW,		// fan of stratified diffuse reflection rays, keep the brightest ones
+	FAST,		// Lambertian shading from the light sources only
+	COSINE,		// one cosine-weighted diffuse reflection ray per hit
+};
+
+extern ShadingMode shadingMode;
+
+// Paths are never cut by Russian roulette at or below 'minPathDepth', and
+// always end after 'maxPathDepth' bounces.
+extern int minPathDepth;
+extern int maxPathDepth;
+
+// Trace either the reflection or the refraction ray at dielectrics, instead of both.
+extern bool fStochasticFresnel;
 
 struct Point3f {
 	float x, y, z;
@@ -181,17 +226,102 @@ struct Matrix3x3 {
 	}
 };
 
-// Utility methods.
+// An axis-aligned bounding box. By default it is empty.
+struct BBox {
+	Point3f pMin, pMax;
+
+	BBox() {
+		pMin = Point3f(INFINITY, INFINITY, INFINITY);
+		pMax = Point3f(-INFINITY, -INFINITY, -INFINITY);
+	}
 
-// Randomly pick a float between -r and +r.
-inline float frand_radius(float r) {
-	return (-r) + static_cast<float>(rand()) / static_cast<float>(RAND_MAX / (2.0f * r));
-}
+	BBox(const Point3f& p) {
+		pMin = p; pMax = p;
+	}
+
+	bool empty() const {
+		return pMin.x > pMax.x || pMin.y > pMax.y || pMin.z > pMax.z;
+	}
+
+	BBox Union(const Point3f& p) const {
+		BBox result;
+		result.pMin = Point3f(std::min(pMin.x, p.x), std::min(pMin.y, p.y), std::min(pMin.z, p.z));
+		result.pMax = Point3f(std::max(pMax.x, p.x), std::max(pMax.y, p.y), std::max(pMax.z, p.z));
+		return result;
+	}
+
+	BBox Union(const BBox& b) const {
+		return b.empty() ? *this : Union(b.pMin).Union(b.pMax);
+	}
+
+	Point3f Center() const {
+		return (pMin + pMax) * 0.5f;
+	}
+
+	Vector3f Diagonal() const;
+
+	// Return the axis with the largest extent: 0 for x, 1 for y, 2 for z.
+	int MaxExtent() const;
+};
+
+// A cone of directions around 'axis'. 'cosTheta' is the cosine of the
+// cone's half angle, -1 means all directions.
+struct DirectionCone {
+	Vector3f axis;
+	float cosTheta;
+
+	DirectionCone() {
+		axis = Vector3f(0, 0, 1.f);
+		cosTheta = -1.0f;
+	}
+
+	DirectionCone(const Vector3f& _axis, float _cosTheta) {
+		axis = _axis;
+		axis.Normalize();
+		cosTheta = _cosTheta;
+	}
+
+	// Return the smallest cone containing both 'a' and 'b'.
+	static DirectionCone Union(const DirectionCone& a, const DirectionCone& b);
+};
+
+// Utility methods.
 
-float _rand();
 float dot(Vector3f v1, Vector3f v2);
+float luminance(const RGBColor& c);
+
+// Fixed point numbers with FIXED_POINT_SCALE steps per unit, for sums that
+// threads add to at once. Unlike float sums, they come out the same whatever
+// order the threads add in.
+long long toFixedPoint(float v);
+float fromFixedPoint(long long v);
+
+// Atomically add 'v' to the fixed point sum 'target'.
+void atomicAdd(std::atomic<long long>& target, float v);
 Vector3f cross(Vector3f v1, Vector3f v2);
 
+// Sine and cosine of 'x', within 2e-7 of the exact ones for |x| up to a few
+// thousand, several times faster than sin and cos. The second form does
+// 'count' angles at once in a loop the compiler vectorizes.
+void fastSinCos(float x, float *s, float *c);
+void fastSinCos(const float *x, float *s, float *c, int count);
+
+// Build an orthonormal frame (u, v, w) around the unit vector 'w'.
+void orthonormalBasis(const Vector3f& w, Vector3f *u, Vector3f *v);
+
+// Pick a direction around the unit vector 'w' with u1, u2 in [0, 1), with
+// the cosine-weighted density cos(theta) / pi.
+Vector3f sampleCosineHemisphere(const Vector3f& w, float u1, float u2);
+
+// Jitter u1, u2 in [0, 1) inside the light grid cell 'gridNum'.
+void lightGridSample(int gridNum, RNG& rng, float *u1, float *u2);
+
+// Ideal dielectric refraction of the unit vector 'dir' through a surface
+// with 'normal' facing against 'dir', from index of refraction 'ni' into
+// 'nt'. Store the refracted direction in 'refrDir' and return the Fresnel
+// reflectance, which is 1 for total internal reflection.
+float refractDielectric(const Vector3f& dir, const Vector3f& normal, float ni, float nt, Vector3f *refrDir);
+
 double get_wall_time();
 double get_cpu_time();
 
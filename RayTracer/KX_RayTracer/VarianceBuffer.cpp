@@ -0,0 +1,38 @@
+#include "VarianceBuffer.h"
+#include <cmath>
+#include <limits>
+
+VarianceBuffer::VarianceBuffer(int _width, int _height) : width(_width), height(_height), pixels(_width * _height)
+{
+}
+
+void VarianceBuffer::Add(int w, int h, const RGBColor& c)
+{
+	Pixel& pixel = pixels[h * width + w];
+	pixel.count++;
+	RGBColor delta = c - pixel.mean;
+	pixel.mean = pixel.mean + delta * (1.0f / pixel.count);
+	pixel.m2 = pixel.m2 + delta * (c - pixel.mean);
+}
+
+// Variance of a channel with 'mean' and 'variance' over 'count' samples,
+// zero if the channel is more than two standard errors above 1.
+static float channelVariance(float mean, float variance, int count)
+{
+	if (mean > 1 && (mean - 1) * (mean - 1) * count > 4 * variance)
+		return 0.0f;
+	return variance;
+}
+
+float VarianceBuffer::GetDeviation(int w, int h) const
+{
+	const Pixel& pixel = pixels[h * width + w];
+	if (pixel.count < 2)
+		return std::numeric_limits<float>::infinity();
+
+	RGBColor variance = pixel.m2 * (1.0f / (pixel.count - 1));
+	float sum = channelVariance(pixel.mean.r, variance.r, pixel.count) +
+		channelVariance(pixel.mean.g, variance.g, pixel.count) +
+		channelVariance(pixel.mean.b, variance.b, pixel.count);
+	return sqrt(sum / 3);
+}
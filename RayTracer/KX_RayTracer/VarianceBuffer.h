@@ -0,0 +1,40 @@
+// Running mean and variance of the samples of every pixel.
+// Welford's algorithm, which stays accurate however many samples are added.
+// Adaptive sampling reads how noisy every pixel is from it to decide which
+// pixels need more samples. Each pixel must only be added to by one thread
+// at a time.
+#ifndef _VARIANCEBUFFER_H
+#define _VARIANCEBUFFER_H
+
+#include <vector>
+#include "SimpleImage.h"
+
+class VarianceBuffer
+{
+public:
+	VarianceBuffer(int _width, int _height);
+
+	void Add(int w, int h, const RGBColor& c);
+
+	int GetCount(int w, int h) const { return pixels[h * width + w].count; }
+
+	// Standard deviation of the samples of pixel (w, h), over the channels,
+	// as it shows in the saved image: channels surely above 1 are clamped
+	// there and count as exact.
+	float GetDeviation(int w, int h) const;
+
+private:
+	struct Pixel {
+		int count;
+		RGBColor mean;
+		RGBColor m2;		// sum of the squared differences from the mean
+
+		Pixel() : count(0) {}
+	};
+
+	int width;
+	int height;
+	std::vector<Pixel> pixels;
+};
+
+#endif
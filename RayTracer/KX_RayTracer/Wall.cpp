@@ -31,11 +31,14 @@ void Wall::GatherLightSources(std::vector<const Surface*>& lights) const
 		lights.push_back(this);
 }
 
-Point3f Wall::GetLightPointInGrid(int gridNum) const
+bool Wall::SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const
 {
-	if (gridNum < LIGHT_SAMPLES / 2)
-		return triangle1->GetLightPointInGrid(gridNum);
-	return triangle2->GetLightPointInGrid(gridNum - LIGHT_SAMPLES / 2);
+	// Pick one of the triangles proportionally to its area, and reuse u1.
+	float area1 = triangle1->GetArea();
+	float frac = area1 / (area1 + triangle2->GetArea());
+	if (u1 < frac)
+		return triangle1->SamplePoint(std::min(u1 / frac, 0.99999994f), u2, p, n);
+	return triangle2->SamplePoint(std::min((u1 - frac) / (1 - frac), 0.99999994f), u2, p, n);
 }
 
 Vector3f Wall::GetNormal(const Point3f& p) const
@@ -44,3 +47,18 @@ Vector3f Wall::GetNormal(const Point3f& p) const
 	// triangle's normal.
 	return triangle1->GetNormal(p);
 }
+
+float Wall::GetArea() const
+{
+	return triangle1->GetArea() + triangle2->GetArea();
+}
+
+BBox Wall::GetBounds() const
+{
+	return triangle1->GetBounds().Union(triangle2->GetBounds());
+}
+
+DirectionCone Wall::GetNormalCone() const
+{
+	return triangle1->GetNormalCone();
+}
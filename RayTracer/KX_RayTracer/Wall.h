@@ -15,10 +15,16 @@ public:
 
 	virtual void GatherLightSources(std::vector<const Surface*>& lights) const;
 
-	virtual Point3f GetLightPointInGrid(int gridNum) const;
+	virtual bool SamplePoint(float u1, float u2, Point3f *p, Vector3f *n) const;
 
 	virtual Vector3f GetNormal(const Point3f& p) const;
 
+	virtual float GetArea() const;
+
+	virtual BBox GetBounds() const;
+
+	virtual DirectionCone GetNormalCone() const;
+
 private:
 	std::unique_ptr<Triangle> triangle1;
 	std::unique_ptr<Triangle> triangle2;